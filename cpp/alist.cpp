@@ -1,638 +1,290 @@
 #include "alist.hpp"
+#include "alist_data.hpp"
+#include "alist_event.hpp"
+#include "alist_parser.hpp"
+#include "alist_query.hpp"
 #include <vector>
 #include <iostream>
 #include <deque>
-#include <iomanip>
 #include <cstring>
+#include <fstream>
+#include <memory>
+#include <utility>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace alist;
 using namespace std;
 
-const string _emptyString;
-const list<const IData *> _emptyList;
-const list<pair<string, const IData *>> _emptyKVList;
-
-class Data : public IData {
-private:
-    Type _type;
-    string * _str;
-    list<const IData *> * _list;
-    list<pair<string, const IData *>> * _kvList;
-
-    friend class ParseOperator;
-
-public:
-    Data()
-        : _type(T_UNKNOWN)
-        , _str(nullptr)
-        , _list(nullptr)
-        , _kvList(nullptr)
-        { }
-
-    Type GetType() const override {
-        return _type;
-    }
-
-    const string & GetString() const override {
-        if (_str) return *_str;
-        else return _emptyString;
-    }
-
-    const list<const IData *> & GetList() const override {
-        if (_list) return *_list;
-        else return _emptyList;
-    }
+void alist::Dump(ostream & o, const IData * d) {
+    static const Serializer compact;
+    compact.Write(o, d);
+}
 
-    const list<pair<string, const IData *>> & GetKVList() const override {
-        if (_kvList) return *_kvList;
-        else return _emptyKVList;
+MappedFile::MappedFile(const char * path)
+    : _data(""), _size(0), _mapped(false) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error(string("cannot open ") + path);
     }
 
-    ~Data() override {
-        delete _str;
-        if (_list) {
-            for (auto item : *_list) {
-                delete item;
-            }
-        }
-
-        if (_kvList) {
-            for (auto && kv : *_kvList) {
-                delete get<1>(kv);
-            }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void * p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            _data = (const char *)p;
+            _size = st.st_size;
+            _mapped = true;
         }
     }
-};
-
-class ParseOperator : public IOperator {
-public:
-    void * AListNew() {
-        auto ret = new Data();
-        ret->_type = Data::T_ALIST;
-        return ret;
-    }
-
-    void * AListAppendItem(void * _d, void * i) {
-        auto d = (Data *)_d;
-        if (d->_list == nullptr) {
-            d->_list = new list<const IData *>();
+    close(fd);
+
+    if (!_mapped) {
+        // Pipes and other unmappable files are read into memory instead.
+        ifstream in(path, ios::binary);
+        ostringstream os;
+        os << in.rdbuf();
+        string content = os.str();
+        if (!content.empty()) {
+            auto buf = new char[content.size()];
+            memcpy(buf, content.data(), content.size());
+            _data = buf;
+            _size = content.size();
         }
-        d->_list->push_back((Data *)i);
-        return d;
     }
+}
 
-    void * AListAppendKV(void * _d, void * _k, bool isLiteral, void * _v) {
-        auto d = (Data *)_d;
-        auto k = (Data *)_k;
-        auto v = (Data *)_v;
-        if (d->_kvList == nullptr) {
-            d->_kvList = new list<pair<string, const IData *>>();
-        }
-        d->_kvList->push_back(make_pair(k->GetString(), v));
-        return d;
-    }
+MappedFile::~MappedFile() {
+    if (_mapped) munmap((void *)_data, _size);
+    else if (_size > 0) delete [] _data;
+}
 
-    void * AListFinalize(void * d) {
-        return d;
-    }
+ParseException::ParseException(const char * w) : _what(w) { }
+const char * ParseException::what() const noexcept { return _what.c_str(); }
 
-    void * StringNew() {
-        auto ret = new Data();
-        ret->_type = Data::T_STRING;
-        return ret;
-    }
+// Owns the operator of a parser created without one. It is a base class
+// rather than a member so that it outlives the BasicParser destructor,
+// which frees pending values through it.
+template<class Op>
+struct OperatorHolder {
+    Op ownedOp;
 
-    void * StringAppendByte(void * _d, unsigned char b) {
-        auto d = (Data *)_d;
-        if (d->_str == nullptr) {
-            d->_str = new string();
-        }
+    template<class... Args>
+    explicit OperatorHolder(Args &&... args) : ownedOp(std::forward<Args>(args)...) { }
+};
 
-        d->_str->push_back(b);
-        return d;
+template<class Syntax, class Op = ParseOperator>
+class DefaultParser : private OperatorHolder<Op>, public BasicParser<Syntax, Op> {
+public:
+    template<class... Args>
+    DefaultParser(const Syntax & syntax, bool multi, Args &&... args)
+        : OperatorHolder<Op>(std::forward<Args>(args)...)
+        , BasicParser<Syntax, Op>(syntax, &this->ownedOp, multi) { }
+
+    void Reset() override {
+        BasicParser<Syntax, Op>::Reset();
+        this->ownedOp.Reset();
     }
+};
 
-    void * StringAppendByteArray(void * _d, const unsigned char * ba, int len) {
-        auto d = (Data *)_d;
-        if (d->_str == nullptr) {
-            d->_str = new string();
-        }
-
-        d->_str->append((const char *)ba, len);
-        return d;
-    }
+static bool IsDefaultSyntax(const char * c_whitespace, const char * c_line_comment,
+                            const char * c_item_sep, const char * c_kv_sep,
+                            const char * c_quote, const char * c_open, const char * c_close) {
+    return strcmp(c_whitespace, DefaultChars::Whitespace()) == 0 &&
+        strcmp(c_line_comment, DefaultChars::LineComment()) == 0 &&
+        strcmp(c_item_sep, DefaultChars::ItemSep()) == 0 &&
+        strcmp(c_kv_sep, DefaultChars::KVSep()) == 0 &&
+        strcmp(c_quote, DefaultChars::Quote()) == 0 &&
+        strcmp(c_open, DefaultChars::Open()) == 0 &&
+        strcmp(c_close, DefaultChars::Close()) == 0;
+}
 
-    void * StringFinalize(void * d) {
-        return d;
+IParser * alist::CreateParser(IOperator * op, bool multi,
+                              const char * c_whitespace,
+                              const char * c_line_comment,
+                              const char * c_item_sep,
+                              const char * c_kv_sep,
+                              const char * c_quote,
+                              const char * c_open,
+                              const char * c_close) {
+    // The default syntax gets a parser with its tables and callbacks
+    // resolved at compile time; anything else goes through RuntimeSyntax.
+    if (IsDefaultSyntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                        c_quote, c_open, c_close)) {
+        if (op == NULL) {
+            return new DefaultParser<DefaultSyntax>(DefaultSyntax(), multi);
+        }
+        return new BasicParser<DefaultSyntax, IOperator>(DefaultSyntax(), op, multi);
     }
 
-    void * LiteralNew(const char * s, int len) {
-        auto ret = new Data();
-        ret->_type = Data::T_LITERAL;
-        ret->_str = new string(s, len);
-        return ret;
+    RuntimeSyntax syntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                         c_quote, c_open, c_close);
+    if (op == NULL) {
+        return new DefaultParser<RuntimeSyntax>(syntax, multi);
     }
+    return new BasicParser<RuntimeSyntax, IOperator>(syntax, op, multi);
+}
 
-    void * Free(void * _d) {
-        auto d = (Data *)_d;
-        delete d;
+IParser * alist::CreateParser(KeyTable & keys, bool multi,
+                              const char * c_whitespace,
+                              const char * c_line_comment,
+                              const char * c_item_sep,
+                              const char * c_kv_sep,
+                              const char * c_quote,
+                              const char * c_open,
+                              const char * c_close) {
+    if (IsDefaultSyntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                        c_quote, c_open, c_close)) {
+        return new DefaultParser<DefaultSyntax>(DefaultSyntax(), multi, keys);
     }
-};
 
-
-#if __cplusplus < 201402L
-#include <sstream>
-string quoted(const string & s) {
-    ostringstream os;
-    os << '"';
-    for (int i = 0; i < s.size(); ++i) {
-        if (32 <= s[i] && s[i] <= 126) {
-            if (s[i] == '"' || s[i] == '\\')
-                os << '\\';
-            os << s[i];
-        }
-        else os << '\\' << 'x' << "0123456789abcdef"[(unsigned char)s[i] >> 4] << "0123456789abcdef"[s[i] & 0xf];
-    }
-    os << '"';
-    return os.str();
+    RuntimeSyntax syntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                         c_quote, c_open, c_close);
+    return new DefaultParser<RuntimeSyntax>(syntax, multi, keys);
 }
-#endif
 
-void alist::Dump(ostream & o, const IData * d) {
-    if (d == nullptr) {
-        o << "(NULL)";
-        return;
+IParser * alist::CreateParser(SubtreeTable & trees, bool multi,
+                              const char * c_whitespace,
+                              const char * c_line_comment,
+                              const char * c_item_sep,
+                              const char * c_kv_sep,
+                              const char * c_quote,
+                              const char * c_open,
+                              const char * c_close) {
+    if (IsDefaultSyntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                        c_quote, c_open, c_close)) {
+        return new DefaultParser<DefaultSyntax>(DefaultSyntax(), multi, trees);
     }
 
-    switch (d->GetType()) {
-    case IData::T_UNKNOWN:
-        o << "(UNKNOWN)";
-        break;
-    case IData::T_LITERAL:
-        o << d->GetString();
-        break;
-    case IData::T_STRING:
-        o << quoted(d->GetString());
-        break;
-    case IData::T_ALIST: {
-        o << '[';
-        bool first = true;
-        for (const IData * ele : d->GetList()) {
-            if (first) first = false;
-            else o << ',';
-            Dump(o, ele);
-        }
-        for (auto && kv : d->GetKVList()) {
-            if (first) first = false;
-            else o << ',';
-            o << get<0>(kv) << "=";
-            Dump(o, get<1>(kv));
-        }
-        o << ']';
-        break;
-    }
-    }
+    RuntimeSyntax syntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                         c_quote, c_open, c_close);
+    return new DefaultParser<RuntimeSyntax>(syntax, multi, trees);
 }
 
-ParseException::ParseException(const char * w) : _what(w) { }
-const char * ParseException::what() const noexcept { return _what.c_str(); }
-
-struct AListValue {
-    bool hasTmp;
-    void * tmp;
-    void * o;
-    bool isString;
-    bool isLiteral;
-};
-
-template<typename I>
-struct CharMap {
-    I m[256];
-
-    CharMap(const char * v, I defaultValue, I setValue) {
-        for (int i = 0; i < 256; ++i) m[i] = defaultValue;
-        while (*v) {
-            m[*v] = setValue;
-            ++v;
-        }
+IParser * alist::CreateTypedParser(bool multi,
+                                   const char * c_whitespace,
+                                   const char * c_line_comment,
+                                   const char * c_item_sep,
+                                   const char * c_kv_sep,
+                                   const char * c_quote,
+                                   const char * c_open,
+                                   const char * c_close) {
+    if (IsDefaultSyntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                        c_quote, c_open, c_close)) {
+        return new DefaultParser<DefaultSyntax>(DefaultSyntax(), multi, true);
     }
 
-    CharMap(const char * v, I defaultValue, const initializer_list<I> & l) {
-        for (int i = 0; i < 256; ++i) m[i] = defaultValue;
-        auto it = begin(l);
-        while (*v && it != end(l)) {
-            m[*v] = *it;
-            ++v; ++it;
-        }
-    }
-
-    void Set(const char * v, I value) {
-        while (*v) {
-            m[*v] = value;
-            ++v;
-        }
-    }
-};
+    RuntimeSyntax syntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                         c_quote, c_open, c_close);
+    return new DefaultParser<RuntimeSyntax>(syntax, multi, true);
+}
 
-static const CharMap<int> HEX_TRANSLATE("0123456789abcdefABCDEF", -1,
-    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 10, 11, 12, 13, 14, 15}
-);
+static RuntimeSyntax MakeSyntax(const string * c, RuntimeSyntax *) {
+    return RuntimeSyntax(c[0].c_str(), c[1].c_str(), c[2].c_str(), c[3].c_str(),
+                         c[4].c_str(), c[5].c_str(), c[6].c_str());
+}
 
-#define BUF_CLEAN_THRESHOLD 4096
+static DefaultSyntax MakeSyntax(const string *, DefaultSyntax *) {
+    return DefaultSyntax();
+}
 
-class AListParser : public IParser {
+// Parses the lazy alists of the documents of one lazy parser, which keep
+// it alive, so it has its own copy of the syntax.
+template<class Syntax>
+class LazyExpander final : public Expander {
 private:
-
-    enum State {
-        STATE_ELEMENT_START,
-        STATE_ELEMENT_END,
-        STATE_ALIST,
-        STATE_ALIST_WITH_KEY,
-        STATE_QUOTED_STRING,
-        STATE_MULTILINE_STRING
-    };
-
-    bool            _multi;
-    bool            _sealed;
-    string          _buf;
-    size_t          _readPos;
-    vector<AListValue> _valueStack;
-    vector<int>     _auxStack;
-    vector<State>   _stateStack;
-    deque<void *>   _results;
-    IOperator *     _op;
-    const char *    _c_whitespace;
-    const char *    _c_line_comment;
-    const char *    _c_item_sep;
-    const char *    _c_kv_sep;
-    const char *    _c_quote;
-    const char *    _c_open;
-    const char *    _c_close;
-    CharMap<bool>   _c_special;
-
-    ParseOperator   _defaultOp;
+    string          _chars[7];
+    Syntax          _syntax;
+    BoundaryScanner _skip;
 
 public:
-
-    AListParser(bool multi, IOperator * op,
-                const char * c_whitespace, const char * c_line_comment,
-                const char * c_item_sep, const char * c_kv_sep,
-                const char * c_quote, const char * c_open, const char * c_close)
-        : _c_special("", false, true)
-        {
-        _multi = multi;
-        _sealed = false;
-        _readPos = 0;
-        _stateStack.push_back(STATE_ELEMENT_START);
-        _op = op == NULL ? &_defaultOp : op;
-        _c_whitespace = c_whitespace;
-        _c_line_comment = c_line_comment;
-        _c_item_sep = c_item_sep;
-        _c_kv_sep = c_kv_sep;
-        _c_quote = c_quote;
-        _c_open = c_open;
-        _c_close = c_close;
-        _c_special.Set(c_whitespace, true);
-        _c_special.Set(c_line_comment, true);
-        _c_special.Set(c_item_sep, true);
-        _c_special.Set(c_kv_sep, true);
-        _c_special.Set(c_quote, true);
-        _c_special.Set(c_open, true);
-        _c_special.Set(c_close, true);
-    }
-
-    void ParseLine(const string & line) override {
-        if (_sealed) return;
-
-        _buf.append(line);
-        ParseBuf();
-    }
-
-    void Seal() override {
-        if (_sealed) return;
-
-        _sealed = true;
-        ParseBuf();
-
-        _readPos = 0;
-        _buf.clear();
-        _stateStack.clear();
-        for (auto && d : _valueStack) {
-            if (d.hasTmp) {
-                _op->Free(d.tmp);
-            }
-            _op->Free(d.o);
-        }
-        _valueStack.clear();
+    LazyExpander(const char * c_whitespace, const char * c_line_comment,
+                 const char * c_item_sep, const char * c_kv_sep,
+                 const char * c_quote, const char * c_open, const char * c_close)
+        : _chars{ c_whitespace, c_line_comment, c_item_sep, c_kv_sep, c_quote, c_open, c_close }
+        , _syntax(MakeSyntax(_chars, (Syntax *)nullptr))
+        , _skip(_chars[0].c_str(), _chars[1].c_str(), _chars[2].c_str(), _chars[3].c_str(),
+                _chars[4].c_str(), _chars[5].c_str(), _chars[6].c_str()) { }
+
+    const Syntax & GetSyntax() const { return _syntax; }
+    const BoundaryScanner & Skip() const { return _skip; }
+
+    Data * Parse(Arena * arena, const char * s, size_t len) const override {
+        ParseOperator op(arena, this);
+        BasicParser<Syntax, ParseOperator> parser(_syntax, &op, false);
+        parser.SetLazy(&_skip);
+        parser.ParseStable(s, len);
+        parser.Seal();
+        auto d = (Data *)parser.Extract();
+        if (d == nullptr) throw ParseException("unterminated alist");
+        return d;
     }
+};
 
-    ~AListParser() {
-        Seal();
-        for (auto d : _results) {
-            _op->Free(d);
-        }
-    }
+template<class Syntax>
+static IParser * NewLazyParser(bool multi, const char * c_whitespace, const char * c_line_comment,
+                               const char * c_item_sep, const char * c_kv_sep,
+                               const char * c_quote, const char * c_open, const char * c_close) {
+    auto expander = make_shared<LazyExpander<Syntax>>(c_whitespace, c_line_comment, c_item_sep,
+                                                       c_kv_sep, c_quote, c_open, c_close);
+    auto parser = new DefaultParser<Syntax>(expander->GetSyntax(), multi, expander);
+    parser->SetLazy(&expander->Skip());
+    return parser;
+}
 
-    void HandleEscape() {
-        if (_readPos >= _buf.size()) return;
-        auto && v = _valueStack.back();
-        switch (_buf[_readPos]) {
-        case 'n':
-            v.o = _op->StringAppendByte(v.o, '\n');
-            ++_readPos;
-            break;
-        case 't':
-            v.o = _op->StringAppendByte(v.o, '\t');
-            ++_readPos;
-            break;
-        case 'r':
-            v.o = _op->StringAppendByte(v.o, '\r');
-            ++_readPos;
-            break;
-        case 'f':
-            v.o = _op->StringAppendByte(v.o, '\f');
-            ++_readPos;
-            break;
-        case 'x':
-        {
-            unsigned char c;
-            int digit;
-
-            if (_readPos + 2 >= _buf.size()) goto InputError;
-            ++_readPos;
-            digit = HEX_TRANSLATE.m[_buf[_readPos]]; if (digit < 0) goto InputError;
-            c = digit; ++_readPos;
-            digit = HEX_TRANSLATE.m[_buf[_readPos]]; if (digit < 0) goto InputError;
-            c = (c << 4) + digit; ++_readPos;
-            v.o = _op->StringAppendByte(v.o, c);
-
-            break;
-
-        InputError:
-            throw ParseException("Expect 2 hex chars for utf-8 escape");
-        }
-        default:
-            v.o = _op->StringAppendByte(v.o, _buf[_readPos]);
-            ++_readPos;
-            break;
-        }
+IParser * alist::CreateLazyParser(bool multi,
+                                  const char * c_whitespace,
+                                  const char * c_line_comment,
+                                  const char * c_item_sep,
+                                  const char * c_kv_sep,
+                                  const char * c_quote,
+                                  const char * c_open,
+                                  const char * c_close) {
+    if (IsDefaultSyntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                        c_quote, c_open, c_close)) {
+        return NewLazyParser<DefaultSyntax>(multi, c_whitespace, c_line_comment, c_item_sep,
+                                            c_kv_sep, c_quote, c_open, c_close);
     }
+    return NewLazyParser<RuntimeSyntax>(multi, c_whitespace, c_line_comment, c_item_sep,
+                                        c_kv_sep, c_quote, c_open, c_close);
+}
 
-    void CleanBuf() {
-        if (_readPos > _buf.size()) _readPos = _buf.size();
-        if (_readPos > BUF_CLEAN_THRESHOLD) {
-            _buf = _buf.substr(_readPos, _buf.size() - _readPos);
-            _readPos = 0;
-        }
+IParser * alist::CreateEventParser(IHandler * handler, bool multi,
+                                   const char * c_whitespace,
+                                   const char * c_line_comment,
+                                   const char * c_item_sep,
+                                   const char * c_kv_sep,
+                                   const char * c_quote,
+                                   const char * c_open,
+                                   const char * c_close) {
+    if (IsDefaultSyntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                        c_quote, c_open, c_close)) {
+        return new DefaultParser<DefaultSyntax, EventOperator>(DefaultSyntax(), multi, handler);
     }
 
-    void ParseBuf() {
-        size_t limit = _buf.size();
-        while (_readPos < limit || (_stateStack.size() > 0 && _stateStack.back() == STATE_ELEMENT_END)) {
-            if (_stateStack.size() == 0) {
-                Seal();
-                return;
-            }
-
-            auto state = _stateStack.back();
-
-            switch (state) {
-            case STATE_ELEMENT_END: {
-                auto value = _valueStack.back();
-
-                _stateStack.pop_back();
-                _auxStack.pop_back();
-                _valueStack.pop_back();
-
-                if (_stateStack.size() == 0) {
-                    _results.push_back(value.o);
-
-                    if (_multi) {
-                        _stateStack.push_back(STATE_ELEMENT_START);
-                    }
-
-                    break;
-                }
-
-                switch (_stateStack.back()) {
-                case STATE_ALIST:
-                {
-                    auto && c = _valueStack.back();
-                    if (c.hasTmp) {
-                        c.o = _op->AListAppendItem(c.o, c.tmp);
-                    }
-                    c.hasTmp = true;
-                    c.tmp = value.o;
-                    c.isString = value.isString;
-                    c.isLiteral = value.isLiteral;
-                    break;
-                }
-
-                case STATE_ALIST_WITH_KEY:
-                {
-                    auto && c = _valueStack.back();
-                    _op->AListAppendKV(c.o, c.tmp, c.isLiteral, value.o);
-                    c.hasTmp = false;
-                    c.tmp = nullptr;
-                    c.isString = false;
-                    c.isLiteral = false;
-                    _stateStack.back() = STATE_ALIST;
-                    break;
-                }
-
-                default:
-                    throw ParseException("invalid state to insert element");
-                }
-                break;
-            }
-            case STATE_QUOTED_STRING: {
-                auto && v = _valueStack.back();
-                size_t s = _readPos;
-                char delim = _c_quote[_auxStack.back()];
-                while (s < limit && _buf[s] != '\'' && _buf[s] != delim) ++s;
-                v.o = _op->StringAppendByteArray(
-                    v.o, (const unsigned char *)_buf.data() + _readPos, s - _readPos);
-
-                if (s >= limit) {
-                    _readPos = limit;
-                    v.o = _op->StringFinalize(v.o);
-                    _stateStack.back() = STATE_ELEMENT_END;
-                }
-                else {
-                    if (_buf[s] == '\\') {
-                        _readPos = s + 1;
-                        HandleEscape();
-                    }
-                    else {
-                        _readPos = s + 1;
-                        v.o = _op->StringFinalize(v.o);
-                        _stateStack.back() = STATE_ELEMENT_END;
-                    }
-                }
-                break;
-            }
-            case STATE_MULTILINE_STRING: {
-                auto && v = _valueStack.back();
-                size_t s = _readPos;
-                char delim = _c_quote[_auxStack.back()];
-                while (s < limit && _buf[s] != '\'' && _buf[s] != delim) ++s;
-                v.o = _op->StringAppendByteArray(
-                    v.o, (const unsigned char *)_buf.data() + _readPos, s - _readPos);
-
-                if (s >= limit) {
-                    v.o = _op->StringAppendByte(v.o, '\n');
-                    _readPos = limit;
-                }
-                else {
-                    if (_buf[s] == '\\') {
-                        _readPos = s + 1;
-                        HandleEscape();
-                    }
-                    else if (s + 2 < limit && _buf[s] == delim && _buf[s + 1] == delim && _buf[s + 2] == delim) {
-                        v.o = _op->StringFinalize(v.o);
-                        _readPos = s + 3;
-                        _stateStack.back() = STATE_ELEMENT_END;
-                    }
-                    else {
-                        v.o = _op->StringAppendByte(v.o, _buf[s]);
-                        _readPos = s + 1;
-                    }
-                }
-                break;
-            }
-            case STATE_ALIST: {
-                auto && v = _valueStack.back();
-                size_t s = _readPos;
-                while (s < limit && strchr(_c_whitespace, _buf[s])) ++s;
-
-                if (s >= limit) {
-                    _readPos = limit;
-                }
-                else if (_buf[s] == _c_close[_auxStack.back()]) {
-                    if (v.hasTmp) {
-                        v.o = _op->AListAppendItem(v.o, v.tmp);
-                        v.hasTmp = false;
-                        v.tmp = nullptr;
-                        v.isString = false;
-                        v.isLiteral = false;
-                    }
-                    v.o = _op->AListFinalize(v.o);
-                    _stateStack.back() = STATE_ELEMENT_END;
-                    _readPos = s + 1;
-                }
-                else if (strchr(_c_item_sep, _buf[s])) {
-                    _readPos = s + 1;
-                    _stateStack.push_back(STATE_ELEMENT_START);
-                }
-                else if (strchr(_c_kv_sep, _buf[s])) {
-                    if (!v.hasTmp) {
-                        throw ParseException("missing key element before '='");
-                    }
-                    else if (!v.isString && !v.isLiteral) {
-                        throw ParseException("key element must be literal or string");
-                    }
-                    _readPos = s + 1;
-                    _stateStack.back() = STATE_ALIST_WITH_KEY;
-                    _stateStack.push_back(STATE_ELEMENT_START);
-                }
-                else if (strchr(_c_line_comment, _buf[s])) {
-                    _readPos = limit;
-                }
-                else {
-                    _readPos = s;
-                    _stateStack.push_back(STATE_ELEMENT_START);
-                }
-
-                break;
-
-            }
-            case STATE_ELEMENT_START: {
-                size_t s = _readPos;
-                while (s < limit && strchr(_c_whitespace, _buf[s])) ++s;
-
-                if (s >= limit) {
-                    _readPos = limit;
-                }
-                else if (strchr(_c_open, _buf[s])) {
-                    _valueStack.push_back(AListValue());
-                    auto && v = _valueStack.back();
-                    v.hasTmp = false;
-                    v.tmp = nullptr;
-                    v.o = _op->AListNew();
-                    _stateStack.back() = STATE_ALIST;
-                    _auxStack.push_back(strchr(_c_open, _buf[s]) - _c_open);
-                    _readPos = s + 1;
-                }
-                else if (strchr(_c_quote, _buf[s])) {
-                    _valueStack.push_back(AListValue());
-                    auto && v = _valueStack.back();
-                    v.hasTmp = false;
-                    v.tmp = nullptr;
-                    v.o = _op->StringNew();
-                    _auxStack.push_back(strchr(_c_quote, _buf[s]) - _c_quote);
-
-                    if (s + 2 < limit &&
-                        _buf[s + 1] == _buf[s] && _buf[s + 2] == _buf[s]) {
-                        _stateStack.back() = STATE_MULTILINE_STRING;
-                        _readPos = s + 3;
-                    }
-                    else {
-                        _stateStack.back() = STATE_QUOTED_STRING;
-                        _readPos = s + 1;
-                    }
-                }
-                else if (strchr(_c_line_comment, _buf[s])) {
-                    _readPos = limit;
-                }
-                else {
-                    size_t e = s;
-                    while (e < limit && !_c_special.m[_buf[e]]) ++e;
-
-                    if (e == s) {
-                        throw ParseException("unexpected char at element start");
-                    }
-
-                    _valueStack.push_back(AListValue());
-                    auto && v = _valueStack.back();
-                    v.hasTmp = false;
-                    v.tmp = nullptr;
-                    v.o = _op->LiteralNew(_buf.data() + s, e - s);
-                    v.isString = false;
-                    v.isLiteral = true;
-
-                    _auxStack.push_back(0);
-                    _stateStack.back() = STATE_ELEMENT_END;
-                    _readPos = e;
-                }
-
-                break;
-            }
-            }
-        }
-
-        CleanBuf();
-    }
+    RuntimeSyntax syntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                         c_quote, c_open, c_close);
+    return new DefaultParser<RuntimeSyntax, EventOperator>(syntax, multi, handler);
+}
 
-    void * Extract() override {
-        if (_results.size() > 0) {
-            auto v = _results.front();
-            _results.pop_front();
-            return v;
-        }
-        else {
-            return nullptr;
-        }
+IParser * alist::CreateQueryParser(const Query & query, IMatchHandler * handler, bool multi,
+                                   const char * c_whitespace,
+                                   const char * c_line_comment,
+                                   const char * c_item_sep,
+                                   const char * c_kv_sep,
+                                   const char * c_quote,
+                                   const char * c_open,
+                                   const char * c_close) {
+    if (IsDefaultSyntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                        c_quote, c_open, c_close)) {
+        return new DefaultParser<DefaultSyntax, QueryOperator>(DefaultSyntax(), multi, query, handler);
     }
-};
 
-IParser * alist::CreateParser(IOperator * op, bool multi,
-                              const char * c_whitespace,
-                              const char * c_line_comment,
-                              const char * c_item_sep,
-                              const char * c_kv_sep,
-                              const char * c_quote,
-                              const char * c_open,
-                              const char * c_close) {
-    return new AListParser(multi, op, c_whitespace, c_line_comment,
-                           c_item_sep, c_kv_sep, c_quote, c_open, c_close);
+    RuntimeSyntax syntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                         c_quote, c_open, c_close);
+    return new DefaultParser<RuntimeSyntax, QueryOperator>(syntax, multi, query, handler);
 }
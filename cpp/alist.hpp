@@ -3,32 +3,234 @@
 
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <cstring>
+#include <cstdint>
 #include <list>
+#include <memory>
 #include <utility>
+#include <vector>
 
 namespace alist {
+    // Non-owning view of a byte range, in the spirit of std::string_view.
+    class Slice {
+    private:
+        const char * _data;
+        size_t       _size;
+    public:
+        Slice() : _data(""), _size(0) { }
+        Slice(const char * d, size_t s) : _data(d), _size(s) { }
+        Slice(const char * s) : _data(s), _size(strlen(s)) { }
+        Slice(const std::string & s) : _data(s.data()), _size(s.size()) { }
+
+        const char * data() const { return _data; }
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+        const char * begin() const { return _data; }
+        const char * end() const { return _data + _size; }
+        char operator[](size_t i) const { return _data[i]; }
+        explicit operator std::string() const { return std::string(_data, _size); }
+
+        bool operator==(const Slice & o) const {
+            return _size == o._size && (_size == 0 || memcmp(_data, o._data, _size) == 0);
+        }
+        bool operator!=(const Slice & o) const { return !(*this == o); }
+    };
+
+    inline std::ostream & operator<<(std::ostream & o, const Slice & s) {
+        return o.write(s.data(), s.size());
+    }
     class IOperator {
     public:
         virtual void * AListNew() = 0;
         virtual void * AListAppendItem(void * d, void * i) = 0;
         virtual void * AListAppendKV(void * d, void * key, bool isLiternal, void * value) = 0;
+        // Called when the key separator follows key, before the value is
+        // parsed. The returned object is passed to AListAppendKV() as the key.
+        virtual void * AListKey(void * /*d*/, void * key, bool /*isLiteral*/) { return key; }
         virtual void * AListFinalize(void * d) = 0;
+        // Called by a lazy parser with the text of a nested alist, brackets
+        // included, in place of parsing it. copy is set when s is only valid
+        // during the call. Returning nullptr has the alist parsed as usual.
+        virtual void * AListLazy(const char * /*s*/, size_t /*len*/, bool /*copy*/) { return nullptr; }
         virtual void * StringNew() = 0;
         virtual void * StringAppendByte(void * d, unsigned char b) = 0;
         virtual void * StringAppendByteArray(void * d, const unsigned char * b, int l) = 0;
         virtual void * StringFinalize(void * d) = 0;
+        // Hint that about n more bytes are going to be appended to d.
+        virtual void * StringReserve(void * d, size_t /*n*/) { return d; }
         virtual void * LiteralNew(const char * str, int len) = 0;
         virtual void * Free(void * d) = 0;
 
+        // Variants of LiteralNew and StringAppendByteArray used by
+        // ParseStable(): the bytes live in the caller's buffer and stay
+        // valid as long as the results do, so they may be kept by
+        // reference instead of copied.
+        virtual void * LiteralRef(const char * str, int len) { return LiteralNew(str, len); }
+        virtual void * StringAppendRef(void * d, const unsigned char * b, int l) {
+            return StringAppendByteArray(d, b, l);
+        }
+
+        // Called once a top-level value is complete, before it is queued
+        // for Extract(). The returned object replaces the value; nullptr
+        // drops it.
+        virtual void * DocumentFinalize(void * d) { return d; }
+
+        // Bytes held by d, a value DocumentFinalize() returned, or with
+        // nullptr by the value being built. Only used to account for a
+        // parser's memory; 0 where not known.
+        virtual size_t MemoryUsed(void * /*d*/) { return 0; }
+
         virtual ~IOperator() = default;
     };
 
+    // Work done by a parser, counted only when the library is built with
+    // ALIST_STATS defined; otherwise every field stays zero.
+    struct ParseStats {
+        // States of the parser state machine.
+        enum State {
+            S_ELEMENT_START,
+            S_ELEMENT_END,
+            S_ALIST,
+            S_ALIST_WITH_KEY,
+            S_QUOTED_STRING,
+            S_MULTILINE_STRING,
+            STATE_COUNT
+        };
+
+        // IOperator callbacks, grouped by what they do.
+        enum Callback {
+            CB_ALIST_NEW,
+            CB_ALIST_APPEND_ITEM,
+            CB_ALIST_KEY,
+            CB_ALIST_APPEND_KV,
+            CB_ALIST_FINALIZE,
+            CB_ALIST_LAZY,
+            CB_STRING_NEW,
+            CB_STRING_APPEND,       // StringAppendByte/ByteArray/Ref
+            CB_STRING_RESERVE,
+            CB_STRING_FINALIZE,
+            CB_LITERAL_NEW,         // LiteralNew/LiteralRef
+            CB_FREE,
+            CB_DOCUMENT_FINALIZE,
+            CALLBACK_COUNT
+        };
+
+        uint64_t bytes;                     // input bytes handed to the state machine
+        uint64_t lines;
+        uint64_t steps[STATE_COUNT];        // state machine steps taken in each state
+        uint64_t callbacks[CALLBACK_COUNT];
+        uint64_t maxDepth;                  // deepest value stack seen
+        uint64_t compactions;               // times buffered input was moved down
+        uint64_t bytesMoved;                // and the bytes moved doing so
+        uint64_t parseNanos;                // time spent running the state machine
+
+        ParseStats() { memset(this, 0, sizeof(*this)); }
+
+        // Adds the counts of o, as for parsers working on parts of one input.
+        void Merge(const ParseStats & o) {
+            bytes += o.bytes;
+            lines += o.lines;
+            for (int i = 0; i < STATE_COUNT; ++i) steps[i] += o.steps[i];
+            for (int i = 0; i < CALLBACK_COUNT; ++i) callbacks[i] += o.callbacks[i];
+            if (o.maxDepth > maxDepth) maxDepth = o.maxDepth;
+            compactions += o.compactions;
+            bytesMoved += o.bytesMoved;
+            parseNanos += o.parseNanos;
+        }
+    };
+
+    // Memory held by a parser, in bytes, as reported by GetMemoryUsage().
+    struct MemoryUsage {
+        size_t buffered;    // input kept from one call to the next, as by Feed()
+        size_t stacks;      // parser stacks and scratch space
+        size_t building;    // the value being built
+        size_t queued;      // results waiting for Extract()
+        size_t results;     // number of those results
+
+        MemoryUsage() : buffered(0), stacks(0), building(0), queued(0), results(0) { }
+
+        size_t Total() const { return buffered + stacks + building + queued; }
+    };
+
+    // Bounds on what Feed() lets a parser hold; 0 leaves one unbounded.
+    // Once the results waiting for Extract() reach maxResults or
+    // maxResultBytes, Feed() takes nothing and returns FEED_WOULD_BLOCK.
+    // An unfinished line longer than maxBuffered is a ParseException, as
+    // extracting results would not make it any shorter.
+    struct ParseLimits {
+        size_t maxBuffered;
+        size_t maxResults;
+        size_t maxResultBytes;
+
+        ParseLimits() : maxBuffered(0), maxResults(0), maxResultBytes(0) { }
+    };
+
+    class IData;
+
+    // Takes the results of a parser as they are completed, in place of
+    // Extract(). Each result is the handler's, as an extracted one is the
+    // caller's.
+    class IResultHandler {
+    public:
+        virtual void OnResult(void * result) = 0;
+        virtual ~IResultHandler() = default;
+    };
+
     class IParser {
     public:
+        enum FeedStatus {
+            FEED_OK,
+            FEED_WOULD_BLOCK
+        };
+
         virtual void ParseLine(const std::string & line) = 0;
+        // Parses a sequence of '\n'-separated lines in place, as if each
+        // had been passed to ParseLine(). Nothing refers to the buffer
+        // after the call returns.
+        virtual void ParseBuffer(const char * data, size_t size) = 0;
+        // Same as ParseBuffer() over a memory-mapped file.
+        virtual void ParseFile(const char * path) = 0;
+        // Parses a sequence of '\n'-separated lines from a buffer that the
+        // caller keeps alive and unmodified while any result is in use.
+        // With the default operator, literals and strings without escapes
+        // or line breaks refer into the buffer instead of being copied.
+        virtual void ParseStable(const char * data, size_t size) = 0;
+        // Parses the next piece of a stream cut at arbitrary points, as
+        // from a socket or pipe. Lines are parsed once they are whole, so
+        // tokens, escapes and multi-line string delimiters may be split
+        // between pieces; the unfinished line is copied and kept until
+        // the rest arrives, or Seal() parses it as the last. A top-level
+        // alist is completed as soon as its closing bracket arrives, even
+        // mid-line. After a ParseException the rest of the piece is
+        // dropped. Mix with the other Parse calls only at line boundaries.
+        // Returns FEED_WOULD_BLOCK, having taken none of the piece, while
+        // queued results are at a limit set by SetLimits(); a piece that
+        // is taken may go past it by the results it completes.
+        virtual FeedStatus Feed(const char * data, size_t size) = 0;
         virtual void Seal() = 0;
+        // Hands each result completed from now on to handler, or queues
+        // it for Extract() again if handler is nullptr. Results already
+        // queued stay there. Reset() clears it.
+        virtual void SetResultHandler(IResultHandler * handler) = 0;
+        // Bounds what Feed() holds from now on; see ParseLimits. The other
+        // Parse calls take their whole input regardless. Reset() clears it.
+        virtual void SetLimits(const ParseLimits & limits) = 0;
+        virtual MemoryUsage GetMemoryUsage() const = 0;
         virtual void * Extract() = 0;
+        // Number of input lines consumed so far, for error reporting.
+        virtual size_t GetLineNumber() const = 0;
+        // Totals since the parser was created or reset; see ParseStats.
+        virtual ParseStats GetStats() const { return ParseStats(); }
+        // Frees any results not extracted and any value left open, and
+        // starts over as a new parser would, unsealed and at line 0. The
+        // memory the parser has grown for its own use is kept.
+        virtual void Reset() = 0;
         virtual ~IParser() = default;
+
+        // Extract() for parsers with the default operator, whose results
+        // are IData trees owned by the caller.
+        std::unique_ptr<const IData> ExtractData();
     };
 
     class ParseException : public std::exception {
@@ -39,6 +241,23 @@ namespace alist {
         const char * what() const noexcept override;
     };
 
+    // Read-only mapping of a whole file. Keep it alive while parsing
+    // it with IParser::ParseStable() to avoid copying its contents.
+    class MappedFile {
+    private:
+        const char * _data;
+        size_t       _size;
+        bool         _mapped;
+    public:
+        explicit MappedFile(const char * path);
+        MappedFile(const MappedFile &) = delete;
+        MappedFile & operator=(const MappedFile &) = delete;
+        ~MappedFile();
+
+        const char * Data() const { return _data; }
+        size_t Size() const { return _size; }
+    };
+
     IParser * CreateParser(IOperator * op = NULL, bool multi = true,
                            const char * c_whitespace = " \t",
                            const char * c_line_comment = "#",
@@ -48,6 +267,178 @@ namespace alist {
                            const char * c_open = "[{",
                            const char * c_close = "]}");
 
+    // Receives the contents of the input as a stream of events, in input
+    // order. A key/value pair is OnKey() followed by its value; a string is
+    // zero or more OnStringChunk() calls followed by OnStringEnd(). Slices
+    // are only valid during the call.
+    class IHandler {
+    public:
+        virtual void OnListBegin() { }
+        virtual void OnKey(const Slice & /*key*/, bool /*isLiteral*/) { }
+        virtual void OnLiteral(const Slice & /*s*/) { }
+        virtual void OnStringChunk(const Slice & /*s*/) { }
+        virtual void OnStringEnd() { }
+        virtual void OnListEnd() { }
+        // Called after each top-level value.
+        virtual void OnDocumentEnd() { }
+        virtual ~IHandler() = default;
+    };
+
+    // Parser that reports the input to handler instead of building values;
+    // its Extract() always returns nullptr. Memory use is bounded by the
+    // nesting depth and the longest scalar, not by the input size. Events
+    // already delivered are not retracted when a ParseException is thrown.
+    IParser * CreateEventParser(IHandler * handler, bool multi = true,
+                                const char * c_whitespace = " \t",
+                                const char * c_line_comment = "#",
+                                const char * c_item_sep = ",",
+                                const char * c_kv_sep = ":=",
+                                const char * c_quote = "'\"",
+                                const char * c_open = "[{",
+                                const char * c_close = "]}");
+
+    // Parser with the default operator that leaves nested alists as text
+    // until they are looked into. Each one found in a buffer is skipped by
+    // a bracket- and quote-aware scan; it is parsed, the same way, when
+    // the first accessor that needs its content (Size(), At(), GetList(),
+    // Find() and so on) is called, and errors in it are thrown from there.
+    // Input given to ParseStable() is referenced and must outlive the
+    // results; ParseBuffer() and ParseFile() copy the text of each nested
+    // alist. Lines given to ParseLine(), and those Feed() carries over from
+    // one piece to the next, are parsed in full.
+    IParser * CreateLazyParser(bool multi = true,
+                               const char * c_whitespace = " \t",
+                               const char * c_line_comment = "#",
+                               const char * c_item_sep = ",",
+                               const char * c_kv_sep = ":=",
+                               const char * c_quote = "'\"",
+                               const char * c_open = "[{",
+                               const char * c_close = "]}");
+
+    // CreateParser() with the default operator, decoding each literal as
+    // it is read, so that IData::GetScalar() and the As*() accessors of
+    // the results are plain loads. Literal text stays available.
+    IParser * CreateTypedParser(bool multi = true,
+                                const char * c_whitespace = " \t",
+                                const char * c_line_comment = "#",
+                                const char * c_item_sep = ",",
+                                const char * c_kv_sep = ":=",
+                                const char * c_quote = "'\"",
+                                const char * c_open = "[{",
+                                const char * c_close = "]}");
+
+    // Parser for a stream of top-level documents built with the default
+    // operator. Each buffer or file handed to it is split at document
+    // boundaries and the pieces are parsed on up to threads threads (0
+    // means one per core); Extract() returns the results in input order.
+    // Feed() collects whole lines until there are enough to be worth
+    // splitting, so its results come later than with other parsers.
+    // On a ParseException the results before the error are kept, the rest
+    // of that input is dropped and GetLineNumber() gives the failing line.
+    IParser * CreateParallelParser(unsigned threads = 0,
+                                   const char * c_whitespace = " \t",
+                                   const char * c_line_comment = "#",
+                                   const char * c_item_sep = ",",
+                                   const char * c_kv_sep = ":=",
+                                   const char * c_quote = "'\"",
+                                   const char * c_open = "[{",
+                                   const char * c_close = "]}");
+
+    // Key interned in a KeyTable. A table holds one Key per distinct key
+    // text, so IData::FindKey() on alists parsed with the same table
+    // compares keys by address instead of by text.
+    class Key {
+    private:
+        // Stored by the table's parsers in place of their own copy.
+        Slice           _text;
+        uint64_t        _hash;
+        const void *    _table;
+
+        friend class KeyTable;
+        friend class Data;
+        friend class ParseOperator;
+        friend class TreeEditor;
+
+    public:
+        Slice Text() const { return _text; }
+    };
+
+    // Keys shared by the documents of any number of parsers. Parsers made
+    // with a table keep every key in it, once, instead of in each
+    // document. It is safe to use from several threads, and documents
+    // hold on to the keys they use, so the table may go before them.
+    class KeyTable {
+    private:
+        struct State;
+        std::shared_ptr<State> _state;
+
+        static const Key * Intern(State & st, const Slice & s, uint64_t hash);
+
+        friend class ParseOperator;
+        friend class TreeEditor;
+
+    public:
+        KeyTable();
+        KeyTable(const KeyTable &) = delete;
+        KeyTable & operator=(const KeyTable &) = delete;
+        ~KeyTable();
+
+        // The Key for s, added if the table does not have it yet.
+        const Key * Intern(const Slice & s);
+        // Number of distinct keys.
+        size_t Size() const;
+    };
+
+    // CreateParser() with the default operator, interning keys in keys.
+    IParser * CreateParser(KeyTable & keys, bool multi = true,
+                           const char * c_whitespace = " \t",
+                           const char * c_line_comment = "#",
+                           const char * c_item_sep = ",",
+                           const char * c_kv_sep = ":=",
+                           const char * c_quote = "'\"",
+                           const char * c_open = "[{",
+                           const char * c_close = "]}");
+
+    class Data;
+
+    // Distinct subtrees, scalars included, of the documents parsed with
+    // it: a subtree that repeats, within a document or across documents,
+    // is held once and shared, and Equal() finds shared subtrees equal
+    // at a glance. Every subtree is kept until the table and all the
+    // documents holding it are gone, so it suits inputs that repeat
+    // more than they change. It is safe to use from several threads.
+    class SubtreeTable {
+    private:
+        struct State;
+        std::shared_ptr<State> _state;
+
+        static const Data * Intern(State & st, const Data * d);
+
+        friend class ParseOperator;
+
+    public:
+        SubtreeTable();
+        SubtreeTable(const SubtreeTable &) = delete;
+        SubtreeTable & operator=(const SubtreeTable &) = delete;
+        ~SubtreeTable();
+
+        // Number of distinct subtrees.
+        size_t Size() const;
+        // Bytes reserved for them.
+        size_t Bytes() const;
+    };
+
+    // CreateParser() with the default operator, sharing subtrees through
+    // trees. Hashes are computed as the documents are built.
+    IParser * CreateParser(SubtreeTable & trees, bool multi = true,
+                           const char * c_whitespace = " \t",
+                           const char * c_line_comment = "#",
+                           const char * c_item_sep = ",",
+                           const char * c_kv_sep = ":=",
+                           const char * c_quote = "'\"",
+                           const char * c_open = "[{",
+                           const char * c_close = "]}");
+
     class IData {
     public:
         enum Type {
@@ -59,12 +450,506 @@ namespace alist {
 
         virtual Type GetType() const = 0;
         virtual const std::string & GetString() const = 0;
+        // Same bytes as GetString() without requiring a std::string.
+        virtual Slice GetSlice() const { return Slice(GetString()); }
         virtual const std::list<const IData *> & GetList() const = 0;
         virtual const std::list<std::pair<std::string, const IData *>> & GetKVList() const = 0;
+
+        // Random access to the positional items and key/value pairs of an
+        // alist. Out of range indices yield nullptr (or an empty key).
+        virtual size_t Size() const { return GetList().size(); }
+        virtual const IData * At(size_t i) const {
+            for (auto item : GetList()) {
+                if (i-- == 0) return item;
+            }
+            return nullptr;
+        }
+        virtual size_t KVSize() const { return GetKVList().size(); }
+        virtual Slice KeyAt(size_t i) const {
+            for (auto && kv : GetKVList()) {
+                if (i-- == 0) return Slice(kv.first);
+            }
+            return Slice();
+        }
+        virtual const IData * ValueAt(size_t i) const {
+            for (auto && kv : GetKVList()) {
+                if (i-- == 0) return kv.second;
+            }
+            return nullptr;
+        }
+        // Value of the first pair with the given key, or nullptr.
+        virtual const IData * Find(const Slice & key) const {
+            for (auto && kv : GetKVList()) {
+                if (Slice(kv.first) == key) return kv.second;
+            }
+            return nullptr;
+        }
+        // Find() by an interned key.
+        virtual const IData * FindKey(const Key & key) const {
+            return Find(key.Text());
+        }
+
+        // What a literal reads as. Numbers follow JSON: an optional '-',
+        // no leading zeros, and a fraction or exponent makes a K_FLOAT, as
+        // does an integer out of the range of int64_t. Anything else, and
+        // numbers out of the range of double, are K_NONE.
+        enum Kind {
+            K_NONE = 0,
+            K_NULL,
+            K_BOOL,
+            K_INT,
+            K_FLOAT
+        };
+
+        struct Scalar {
+            Kind kind;
+            union {
+                bool    b;
+                int64_t i;
+                double  f;
+            };
+            Scalar() : kind(K_NONE), i(0) { }
+        };
+
+        // Decodes s as a literal, without regard to the locale.
+        static Scalar Decode(const Slice & s);
+
+        // The value of a literal; K_NONE for strings and alists. Nodes
+        // built by a parser from CreateTypedParser() hold it already,
+        // others decode their text on each call.
+        virtual Scalar GetScalar() const {
+            return GetType() == T_LITERAL ? Decode(GetSlice()) : Scalar();
+        }
+        bool IsNull() const { return GetScalar().kind == K_NULL; }
+        // Each sets v and returns true if the value is of that kind;
+        // AsDouble() takes integers as well.
+        bool AsBool(bool & v) const {
+            Scalar s = GetScalar();
+            if (s.kind != K_BOOL) return false;
+            v = s.b;
+            return true;
+        }
+        bool AsInt64(int64_t & v) const {
+            Scalar s = GetScalar();
+            if (s.kind != K_INT) return false;
+            v = s.i;
+            return true;
+        }
+        bool AsDouble(double & v) const {
+            Scalar s = GetScalar();
+            if (s.kind == K_FLOAT) v = s.f;
+            else if (s.kind == K_INT) v = (double)s.i;
+            else return false;
+            return true;
+        }
+
+        // Structural hash: trees that Equal() finds equal hash the same.
+        // It covers the whole tree, so nodes that can keep it (those of
+        // the default operator) compute it once, bottom-up, for every
+        // node below at the same time.
+        uint64_t Hash() const;
+        // The hash kept by the node, if it has one, and a place to keep
+        // it; used by Hash() and Equal().
+        virtual bool CachedHash(uint64_t & /*h*/) const { return false; }
+        virtual void CacheHash(uint64_t /*h*/) const { }
+
         virtual ~IData() = default;
     };
 
+    inline std::unique_ptr<const IData> IParser::ExtractData() {
+        return std::unique_ptr<const IData>((const IData *)Extract());
+    }
+
     void Dump(std::ostream & o, const IData * d);
+
+    // Whether a and b hold the same tree: types, scalar text, items in
+    // order and pairs in order, keys compared by text. Subtrees whose
+    // hashes differ are told apart without being walked, and shared
+    // subtrees without being compared.
+    bool Equal(const IData * a, const IData * b);
+
+    // Edits that turn a into b, as a document of the default operator
+    // (so Serializer writes it as alist text and BinaryEncoder as binary)
+    // holding the operations ApplyPatch() carries out, in order:
+    //   [set PATH value]           replaces the value PATH reaches
+    //   [ins PATH value]           inserts an item before the index PATH
+    //                              ends with
+    //   [ins PATH value at=N]      inserts a pair with the key PATH ends
+    //                              with as pair N; without at, as the last
+    //   [del PATH]                 removes the item or the pair PATH reaches
+    //   [del PATH N]               removes N items from the index PATH
+    //                              ends with
+    // A PATH is an alist of steps from the root: a literal number is an
+    // item index and anything else a key, reaching the value of the first
+    // pair with it; [] is the root itself. Pairs are matched by key, and
+    // items aligned on equal subtrees that occur once on each side, with
+    // the items between them changed in place where they line up. Equal
+    // subtrees are skipped by hash, so trees of the default operator,
+    // which keep their hashes, are compared in time about proportional to
+    // their size and the diff grows with what changed. An alist with
+    // duplicate keys is replaced whole if it changed at all.
+    std::unique_ptr<const IData> Diff(const IData * a, const IData * b);
+
+    // Carries out the operations of patch on doc, the root of a document
+    // of the default operator, in place. Nodes doc shares with other
+    // documents, through a SubtreeTable or otherwise, are copied before
+    // they are changed; IData pointers into the parts of doc the patch
+    // does not touch stay valid. Nothing may read doc meanwhile. Throws
+    // std::invalid_argument for an operation it does not understand and
+    // std::out_of_range for a path doc does not have; the operations
+    // before that one stay applied.
+    void ApplyPatch(IData * doc, const IData * patch);
+
+    // Parsers made by CreateParser() with the default operator, kept for
+    // reuse by any number of threads. A parser is handed out by Acquire()
+    // and comes back, reset, when its handle goes. Idle parsers are kept
+    // in shards, one picked by thread, so threads seldom wait for each
+    // other; the pool must outlive every handle it gave out.
+    class ParserPool {
+    private:
+        struct State;
+        State * _state;
+
+    public:
+        // Deleter of Handle: resets the parser and puts it back.
+        class Recycler {
+        private:
+            ParserPool * _pool;
+        public:
+            explicit Recycler(ParserPool * pool = nullptr) : _pool(pool) { }
+            void operator()(IParser * parser) const;
+        };
+
+        typedef std::unique_ptr<IParser, Recycler> Handle;
+
+        explicit ParserPool(bool multi = true,
+                            const char * c_whitespace = " \t",
+                            const char * c_line_comment = "#",
+                            const char * c_item_sep = ",",
+                            const char * c_kv_sep = ":=",
+                            const char * c_quote = "'\"",
+                            const char * c_open = "[{",
+                            const char * c_close = "]}");
+        ParserPool(const ParserPool &) = delete;
+        ParserPool & operator=(const ParserPool &) = delete;
+        ~ParserPool();
+
+        // An idle parser, or a new one if there is none at hand.
+        Handle Acquire();
+        // Parses data with a parser from the pool and returns what it
+        // produced. Throws ParseException if data does not parse.
+        std::vector<std::unique_ptr<const IData>> Parse(const char * data, size_t size);
+        // Number of parsers waiting in the pool.
+        size_t Idle() const;
+    };
+
+    class ByteScanner;
+
+    // Writes IData trees back as alist text that CreateParser() with the
+    // same delimiter sets reads into the same tree. The first character of
+    // each set is the one written, so the defaults are CreateParser()'s
+    // with '=' and '"' first. Literals that would not read back as
+    // literals are written as strings. Compact output is what Dump()
+    // prints; pretty output puts each element on its own indented line.
+    class Serializer {
+    private:
+        bool            _pretty;
+        int             _indent;
+        char            _itemSep;
+        char            _kvSep;
+        char            _quote;
+        char            _open;
+        char            _close;
+        // Bytes that end a literal.
+        ByteScanner *   _special;
+
+        void Write(std::string & out, const IData * d, int fd, std::ostream * os) const;
+
+    public:
+        explicit Serializer(bool pretty = false, int indent = 2,
+                            const char * c_whitespace = " \t",
+                            const char * c_line_comment = "#",
+                            const char * c_item_sep = ",",
+                            const char * c_kv_sep = "=:",
+                            const char * c_quote = "\"'",
+                            const char * c_open = "[{",
+                            const char * c_close = "]}");
+        Serializer(const Serializer &) = delete;
+        Serializer & operator=(const Serializer &) = delete;
+        ~Serializer();
+
+        // Appends the text of d to out.
+        void Write(std::string & out, const IData * d) const;
+        // Writes the text of d to a file descriptor, throwing
+        // std::runtime_error if that fails.
+        void Write(int fd, const IData * d) const;
+        void Write(std::ostream & o, const IData * d) const;
+    };
+
+    // Encodes trees in the binary alist format read by BinaryDocument: a
+    // header, the nodes with children referenced by 32-bit offsets, a
+    // table of distinct keys and the list of top-level values. Strings are
+    // length-prefixed and every field is a native-endian 32-bit word, so
+    // the whole file must stay under 4GB.
+    class BinaryEncoder {
+    private:
+        struct State;
+        State * _state;
+
+    public:
+        BinaryEncoder();
+        BinaryEncoder(const BinaryEncoder &) = delete;
+        BinaryEncoder & operator=(const BinaryEncoder &) = delete;
+        ~BinaryEncoder();
+
+        // Appends d as the next top-level value.
+        void Add(const IData * d);
+        // Appends the encoded file to out and starts over.
+        void Finish(std::string & out);
+    };
+
+    // Binary alist file read in place. Nothing is decoded up front: the
+    // IData of a node is created the first time it is reached and stays
+    // valid, owned by the document, until the document is deleted.
+    class BinaryDocument {
+    private:
+        struct State;
+        State * _state;
+
+    public:
+        // Maps the file at path.
+        explicit BinaryDocument(const char * path);
+        // Reads data, which must be 4-byte aligned and outlive the document.
+        BinaryDocument(const char * data, size_t size);
+        BinaryDocument(const BinaryDocument &) = delete;
+        BinaryDocument & operator=(const BinaryDocument &) = delete;
+        ~BinaryDocument();
+
+        // Number of top-level values.
+        size_t Size() const;
+        const IData * At(size_t i) const;
+    };
+
+    // Text kept parsed across edits. The parse records where each
+    // top-level value and nested alist lies in the text; an edit re-parses
+    // only the smallest alist around it (or, between top-level values, the
+    // lines it touches) and splices the result into the tree. Nodes outside
+    // that range are left as they are, so IData pointers to them stay
+    // valid; nodes replaced stay allocated until their top-level value is
+    // re-parsed as a whole or the document is deleted.
+    class IncrementalDocument {
+    private:
+        struct State;
+        State * _state;
+
+    public:
+        // Parses text with the syntax CreateParser() takes. If it does not
+        // parse, the document holds no values and ErrorLine() is set, as
+        // after a failed Edit().
+        explicit IncrementalDocument(const std::string & text,
+                                     const char * c_whitespace = " \t",
+                                     const char * c_line_comment = "#",
+                                     const char * c_item_sep = ",",
+                                     const char * c_kv_sep = ":=",
+                                     const char * c_quote = "'\"",
+                                     const char * c_open = "[{",
+                                     const char * c_close = "]}");
+        IncrementalDocument(const IncrementalDocument &) = delete;
+        IncrementalDocument & operator=(const IncrementalDocument &) = delete;
+        ~IncrementalDocument();
+
+        // Replaces the len bytes at offset with text. If the result does
+        // not parse, the text is still changed but the tree keeps its last
+        // good state, ParseException is thrown and ErrorLine() is set;
+        // until the text parses again each edit re-parses all of it.
+        void Edit(size_t offset, size_t len, const Slice & text);
+
+        const std::string & Text() const;
+        // 1-based line of the parse error, or 0 while the tree matches the text.
+        size_t ErrorLine() const;
+        // Number of complete top-level values; an unfinished one at the
+        // end of the text is not included.
+        size_t Size() const;
+        const IData * At(size_t i) const;
+    };
+
+    // Document changed by writers while any number of threads read it.
+    // Readers hold snapshots: immutable trees that stay as they are for
+    // as long as they are held. Writers change the document through an
+    // Edit, one at a time, and committing it publishes a new snapshot
+    // that shares every node it did not change with the one before. A
+    // change copies only the alists on the way down to it, each at most
+    // once per edit, in time proportional to their sizes, so changes to
+    // wide alists are best gathered into few edits. Nodes that only old
+    // snapshots reach are freed with them once the tree has been
+    // compacted, copied whole into new nodes, which a commit does when
+    // the edits since the last compaction have taken about as much memory
+    // as the tree had then. The copy keeps neither keys interned in a
+    // KeyTable nor subtrees shared through a SubtreeTable.
+    class MutableDocument {
+    private:
+        struct State;
+        State * _state;
+
+    public:
+        typedef std::shared_ptr<const IData> Snapshot;
+
+        // A step of a path: an item index, or a key, reaching the value of
+        // the first pair with it. The step keeps a copy of the key.
+        class Step {
+        private:
+            bool        _isKey;
+            size_t      _index;
+            std::string _key;
+
+        public:
+            Step(int index) : _isKey(false), _index((size_t)index) { }
+            Step(size_t index) : _isKey(false), _index(index) { }
+            Step(const char * key) : _isKey(true), _index(0), _key(key) { }
+            Step(std::string key) : _isKey(true), _index(0), _key(std::move(key)) { }
+            Step(const Slice & key) : _isKey(true), _index(0), _key(key.data(), key.size()) { }
+
+            bool IsKey() const { return _isKey; }
+            size_t Index() const { return _index; }
+            Slice Key() const { return Slice(_key); }
+        };
+
+        // Steps from the root; the empty path is the root itself.
+        typedef std::vector<Step> Path;
+
+        // Changes made to the latest snapshot, seen by no reader until they
+        // are committed; dropped if they never are. Values are copied in.
+        // An operation that throws std::out_of_range, for a path the tree
+        // does not have, leaves the tree as it was. Nothing but the
+        // destructor may be called once the edit is committed.
+        class Edit {
+        private:
+            struct State;
+            std::unique_ptr<State> _state;
+
+            friend class MutableDocument;
+            explicit Edit(MutableDocument::State * doc);
+
+        public:
+            Edit(Edit && o);
+            Edit & operator=(Edit && o);
+            ~Edit();
+
+            // Replaces the value path reaches with value or with a literal.
+            Edit & Set(const Path & path, const IData * value);
+            Edit & Set(const Path & path, const Slice & literal);
+            // Inserts value or a literal before the item index path ends
+            // with, or as pair at (the last by default) with the key it
+            // ends with.
+            Edit & Insert(const Path & path, const IData * value, size_t at = SIZE_MAX);
+            Edit & Insert(const Path & path, const Slice & literal, size_t at = SIZE_MAX);
+            // Removes count items from the index path ends with, or the
+            // pair it reaches.
+            Edit & Remove(const Path & path, size_t count = 1);
+            // Carries out the operations of a patch from Diff(), as
+            // ApplyPatch() does; if one throws, those before it stay.
+            Edit & Apply(const IData * patch);
+
+            // The tree as the edit has it so far.
+            const IData * Get() const;
+            // Publishes the tree as the latest snapshot and returns it; the
+            // next writer may start. Does nothing if nothing was changed.
+            Snapshot Commit();
+        };
+
+        // Snapshot of the document as one reader last saw it. While no
+        // new snapshot is published Get() costs one atomic load; after
+        // that, one MutableDocument::Get().
+        class Reader {
+        private:
+            const MutableDocument * _doc;
+            uint64_t    _version;
+            Snapshot    _snapshot;
+
+        public:
+            explicit Reader(const MutableDocument & doc);
+
+            // The latest snapshot, valid until the next call.
+            const IData * Get();
+        };
+
+        // Starts from doc, a document of the default operator, whose nodes
+        // the snapshots share until they are changed.
+        explicit MutableDocument(std::unique_ptr<const IData> doc);
+        MutableDocument(const MutableDocument &) = delete;
+        MutableDocument & operator=(const MutableDocument &) = delete;
+        ~MutableDocument();
+
+        // The latest snapshot, taken with the atomic operations on
+        // std::shared_ptr, so without waiting for writers.
+        Snapshot Get() const;
+        // Number of snapshots published since the document was made.
+        uint64_t Version() const;
+        // Starts an edit of the latest snapshot, once the edit in
+        // progress, if any, is committed or dropped.
+        Edit Begin();
+    };
+
+    // Path to values inside an alist, compiled once and evaluated any
+    // number of times, from any number of threads. Steps are applied left
+    // to right, each to the values the previous ones reached:
+    //   key, .key      value of the first pair with that key, as Find()
+    //   ["key"]        same, for keys with '.', '[' or ']' in them; either
+    //                  quote, with '\' escaping the next character
+    //   [N]            N-th positional item, from 0
+    //   *, .*, [*]     every item and pair value
+    //   ..step         step applied from the value and from every value
+    //                  below it
+    // so "servers[3].port", "*.name" and "..port" are queries. The empty
+    // query reaches the value itself.
+    class Query {
+    private:
+        struct Program;
+        Program * _program;
+
+        friend class QueryOperator;
+
+    public:
+        // Throws std::invalid_argument if path is not a query.
+        explicit Query(const Slice & path);
+        Query(const Query &) = delete;
+        Query & operator=(const Query &) = delete;
+        ~Query();
+
+        // Appends the values reached from d to out: a value before the
+        // ones inside it, and the items of an alist before its pairs.
+        void Eval(const IData * d, std::vector<const IData *> & out) const;
+        // First value Eval() would append, or nullptr.
+        const IData * First(const IData * d) const;
+    };
+
+    // Receives the values a streamed Query reaches, in the order they
+    // begin in the input. A value, and everything reached through it, is
+    // only valid during the call.
+    class IMatchHandler {
+    public:
+        virtual void OnMatch(const IData * value) = 0;
+        // Called after each top-level value.
+        virtual void OnDocumentEnd() { }
+        virtual ~IMatchHandler() = default;
+    };
+
+    // Parser that evaluates query against each top-level value as it is
+    // read, without building the values: only those the query reaches are
+    // built, each handed to handler once complete and freed after. Its
+    // Extract() always returns nullptr. query must outlive the parser.
+    // A match is reported before its top-level value is known to be
+    // complete and is not withdrawn if that value turns out not to be,
+    // because a ParseException is thrown or the input ends inside it.
+    // Query::Eval() over the parsed values has no such matches.
+    IParser * CreateQueryParser(const Query & query, IMatchHandler * handler, bool multi = true,
+                                const char * c_whitespace = " \t",
+                                const char * c_line_comment = "#",
+                                const char * c_item_sep = ",",
+                                const char * c_kv_sep = ":=",
+                                const char * c_quote = "'\"",
+                                const char * c_open = "[{",
+                                const char * c_close = "]}");
 }
 
 #endif
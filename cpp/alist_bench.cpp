@@ -0,0 +1,387 @@
+#include "alist.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace alist;
+using namespace std;
+
+// Every allocation made by the process is counted here.
+static atomic<size_t> allocations(0);
+
+void * operator new(size_t n) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (void * p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+
+void * operator new[](size_t n) {
+    return operator new(n);
+}
+
+void * operator new(size_t n, const nothrow_t &) noexcept {
+    allocations.fetch_add(1, memory_order_relaxed);
+    return malloc(n ? n : 1);
+}
+
+void * operator new[](size_t n, const nothrow_t & t) noexcept {
+    return operator new(n, t);
+}
+
+void operator delete(void * p) noexcept { free(p); }
+void operator delete[](void * p) noexcept { free(p); }
+void operator delete(void * p, size_t) noexcept { free(p); }
+void operator delete[](void * p, size_t) noexcept { free(p); }
+
+// Deterministic corpora, each about size bytes of '\n'-separated text.
+class Corpus {
+private:
+    string      _out;
+    uint64_t    _seed;
+
+    unsigned Next(unsigned n) {
+        _seed = _seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (unsigned)(_seed >> 33) % n;
+    }
+
+    void Word() {
+        static const char * words[] = {
+            "alpha", "beta", "gamma", "delta", "42", "-3.25", "true", "false", "null", "x_1"
+        };
+        _out.append(words[Next(10)]);
+    }
+
+    void Text(size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            _out.push_back(Next(8) == 0 ? ' ' : (char)('a' + Next(26)));
+        }
+    }
+
+    void Deep(size_t depth) {
+        for (size_t i = 0; i < depth; ++i) {
+            _out.append("[k");
+            _out.append(to_string(i));
+            _out.append(" = ");
+        }
+        Word();
+        _out.append(depth, ']');
+        _out.push_back('\n');
+    }
+
+    void Wide(size_t width) {
+        _out.push_back('[');
+        for (size_t i = 0; i < width; ++i) {
+            if (i) _out.append(", ");
+            if (i % 4 == 0) {
+                _out.append("f");
+                _out.append(to_string(i));
+                _out.append(" = ");
+            }
+            Word();
+        }
+        _out.append("]\n");
+    }
+
+    void LongString() {
+        _out.append("[body = \"");
+        Text(1024 + Next(4096));
+        _out.append("\"]\n");
+    }
+
+    void EscapedString() {
+        static const char * escapes[] = { "\\n", "\\t", "\\\"", "\\\\", "\\x41", "\\xe4" };
+        _out.append("[text = \"");
+        for (size_t i = 0, n = 64 + Next(512); i < n; ++i) {
+            if (Next(3) == 0) _out.append(escapes[Next(6)]);
+            else _out.push_back((char)('a' + Next(26)));
+        }
+        _out.append("\"]\n");
+    }
+
+    void Multiline() {
+        _out.append("[doc = \"\"\"\n");
+        for (size_t i = 0, n = 20 + Next(30); i < n; ++i) {
+            Text(20 + Next(60));
+            _out.push_back('\n');
+        }
+        _out.append("\"\"\"]\n");
+    }
+
+    void Small() {
+        _out.append("[id = ");
+        _out.append(to_string(Next(1000000)));
+        _out.append(", name = \"");
+        Text(4 + Next(12));
+        _out.append("\", ok = ");
+        Word();
+        _out.append("]\n");
+    }
+
+public:
+    static const char * const KINDS[];
+
+    // Returns an empty string for an unknown kind.
+    string Generate(const string & kind, size_t size) {
+        _out.clear();
+        _seed = 1;
+        while (_out.size() < size) {
+            if (kind == "deep") Deep(64 + Next(192));
+            else if (kind == "wide") Wide(5000);
+            else if (kind == "strings") LongString();
+            else if (kind == "escapes") EscapedString();
+            else if (kind == "multiline") Multiline();
+            else if (kind == "small") Small();
+            else if (kind == "mixed") {
+                switch (Next(6)) {
+                case 0: Deep(16); break;
+                case 1: Wide(64); break;
+                case 2: LongString(); break;
+                case 3: EscapedString(); break;
+                case 4: Multiline(); break;
+                default: Small(); break;
+                }
+            }
+            else break;
+        }
+        return _out;
+    }
+};
+
+const char * const Corpus::KINDS[] = {
+    "deep", "wide", "strings", "escapes", "multiline", "small", "mixed", nullptr
+};
+
+static size_t CountNodes(const IData * d) {
+    size_t n = 0;
+    vector<const IData *> stack(1, d);
+    while (!stack.empty()) {
+        auto v = stack.back();
+        stack.pop_back();
+        ++n;
+        if (v == nullptr || v->GetType() != IData::T_ALIST) continue;
+        for (size_t i = 0; i < v->Size(); ++i) stack.push_back(v->At(i));
+        for (size_t i = 0; i < v->KVSize(); ++i) stack.push_back(v->ValueAt(i));
+    }
+    return n;
+}
+
+struct Result {
+    double  seconds;
+    size_t  bytes;
+    size_t  allocations;
+    size_t  nodes;
+};
+
+static vector<IData *> Drain(IParser * parser) {
+    vector<IData *> docs;
+    while (auto v = parser->Extract()) docs.push_back((IData *)v);
+    return docs;
+}
+
+static void Free(vector<IData *> & docs) {
+    for (auto d : docs) delete d;
+    docs.clear();
+}
+
+// Counts the matches of a streamed query.
+class MatchCounter : public IMatchHandler {
+public:
+    size_t  matches = 0;
+
+    void OnMatch(const IData *) override { ++matches; }
+};
+
+// Keeps the results a parser hands over as it goes.
+class ResultCollector : public IResultHandler {
+public:
+    vector<IData *> docs;
+
+    void OnResult(void * result) override { docs.push_back((IData *)result); }
+};
+
+// One run of mode over input. Parse modes are measured from parser
+// creation until all results are extracted (lazy also reads the top level
+// of each; query extracts nothing, it streams "..id" over the input;
+// feed hands the input over in 16-byte pieces, as a socket might; typed
+// decodes literals as buffer parses);
+// dump measures serializing results parsed beforehand.
+static Result Run(const string & mode, const string & input) {
+    Result r = { 0, input.size(), 0, 0 };
+    vector<IData *> docs;
+
+    if (mode == "dump") {
+        IParser * parser = CreateParser();
+        parser->ParseBuffer(input.data(), input.size());
+        parser->Seal();
+        docs = Drain(parser);
+        delete parser;
+    }
+
+    size_t before = allocations.load();
+    auto start = chrono::steady_clock::now();
+
+    if (mode == "line") {
+        IParser * parser = CreateParser();
+        size_t pos = 0;
+        while (pos < input.size()) {
+            size_t nl = input.find('\n', pos);
+            if (nl == string::npos) nl = input.size();
+            parser->ParseLine(input.substr(pos, nl - pos));
+            pos = nl + 1;
+        }
+        parser->Seal();
+        docs = Drain(parser);
+        delete parser;
+    }
+    else if (mode == "buffer" || mode == "typed" || mode == "parallel") {
+        IParser * parser = mode == "buffer" ? CreateParser() :
+            mode == "typed" ? CreateTypedParser() : CreateParallelParser();
+        parser->ParseBuffer(input.data(), input.size());
+        parser->Seal();
+        docs = Drain(parser);
+        delete parser;
+    }
+    else if (mode == "feed") {
+        ResultCollector collector;
+        IParser * parser = CreateParser();
+        parser->SetResultHandler(&collector);
+        for (size_t pos = 0; pos < input.size(); pos += 16) {
+            parser->Feed(input.data() + pos, min<size_t>(16, input.size() - pos));
+        }
+        parser->Seal();
+        delete parser;
+        docs.swap(collector.docs);
+    }
+    else if (mode == "lazy") {
+        // Only the top level of each document is read, which is what
+        // lazy parsing is for; nodes counts just what was read.
+        IParser * parser = CreateLazyParser();
+        parser->ParseStable(input.data(), input.size());
+        parser->Seal();
+        docs = Drain(parser);
+        delete parser;
+        for (auto d : docs) r.nodes += 1 + d->Size() + d->KVSize();
+    }
+    else if (mode == "query") {
+        // Streams a query through the parser without building the
+        // documents; nodes counts the matches.
+        static const Query query("..id");
+        MatchCounter counter;
+        IParser * parser = CreateQueryParser(query, &counter);
+        parser->ParseStable(input.data(), input.size());
+        parser->Seal();
+        delete parser;
+        r.nodes = counter.matches;
+    }
+    else if (mode == "dump") {
+        Serializer serializer;
+        string out;
+        for (auto d : docs) {
+            serializer.Write(out, d);
+            out.push_back('\n');
+        }
+        r.bytes = out.size();
+    }
+
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    r.allocations = allocations.load() - before;
+    if (mode != "lazy" && mode != "query") {
+        for (auto d : docs) r.nodes += CountNodes(d);
+    }
+    Free(docs);
+    return r;
+}
+
+static const char * const MODES[] = { "line", "buffer", "typed", "feed", "parallel", "lazy", "query", "dump", nullptr };
+
+static void Usage() {
+    cerr << "usage: alist_bench [-s MB] [-r REPEAT] [-c] [CORPUS...]\n"
+            "       alist_bench -g CORPUS [-s MB]\n"
+            "corpora: ";
+    for (int i = 0; Corpus::KINDS[i]; ++i) cerr << Corpus::KINDS[i] << ' ';
+    cerr << "\n-g writes the corpus to stdout; -c prints CSV.\n";
+}
+
+int main(int argc, char ** argv) {
+    size_t size = 8;
+    int repeat = 3;
+    bool csv = false;
+    const char * generate = nullptr;
+    vector<string> kinds;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-s" && i + 1 < argc) size = strtoul(argv[++i], nullptr, 10);
+        else if (arg == "-r" && i + 1 < argc) repeat = atoi(argv[++i]);
+        else if (arg == "-g" && i + 1 < argc) generate = argv[++i];
+        else if (arg == "-c") csv = true;
+        else if (arg[0] == '-') { Usage(); return 1; }
+        else kinds.push_back(arg);
+    }
+    size *= 1024 * 1024;
+
+    Corpus corpus;
+    if (generate) {
+        string text = corpus.Generate(generate, size);
+        if (text.empty()) { Usage(); return 1; }
+        cout.write(text.data(), text.size());
+        return 0;
+    }
+
+    if (kinds.empty()) {
+        for (int i = 0; Corpus::KINDS[i]; ++i) kinds.push_back(Corpus::KINDS[i]);
+    }
+
+    if (csv) cout << "corpus,mode,mb_per_s,allocs_per_node,peak_rss_mb" << endl;
+    else printf("%-10s %-9s %10s %12s %13s\n", "corpus", "mode", "MB/s", "allocs/node", "peak RSS MB");
+    fflush(stdout);
+
+    for (auto && kind : kinds) {
+        string input = corpus.Generate(kind, size);
+        if (input.empty()) { Usage(); return 1; }
+
+        for (int m = 0; MODES[m]; ++m) {
+            // Each measurement runs in its own process so that the peak
+            // RSS reported belongs to it alone.
+            pid_t pid = fork();
+            if (pid < 0) { perror("fork"); return 1; }
+            if (pid == 0) {
+                Result best = { 0, 0, 0, 0 };
+                try {
+                    for (int r = 0; r < repeat; ++r) {
+                        Result res = Run(MODES[m], input);
+                        if (r == 0 || res.seconds < best.seconds) best = res;
+                    }
+                }
+                catch (const exception & e) {
+                    fprintf(stderr, "%s/%s: %s\n", kind.c_str(), MODES[m], e.what());
+                    _exit(1);
+                }
+
+                struct rusage usage;
+                getrusage(RUSAGE_SELF, &usage);
+                double mbs = best.bytes / 1048576.0 / best.seconds;
+                double perNode = best.nodes ? (double)best.allocations / best.nodes : 0;
+                double rss = usage.ru_maxrss / 1024.0;
+                if (csv) printf("%s,%s,%.1f,%.3f,%.1f\n", kind.c_str(), MODES[m], mbs, perNode, rss);
+                else printf("%-10s %-9s %10.1f %12.3f %13.1f\n", kind.c_str(), MODES[m], mbs, perNode, rss);
+                fflush(stdout);
+                _exit(0);
+            }
+
+            int status;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return 1;
+        }
+    }
+    return 0;
+}
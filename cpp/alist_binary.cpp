@@ -0,0 +1,460 @@
+#include "alist.hpp"
+#include "alist_data.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace alist;
+using namespace std;
+
+// File layout, in 32-bit words:
+//
+//   header   MAGIC VERSION nodeCount rootCount rootTable keyCount keyTable size
+//   node     (id << 2 | type) followed by
+//              literal, string:  length, bytes padded to a word
+//              alist:            itemCount kvCount mask,
+//                                itemCount node offsets,
+//                                kvCount (key index, node offset) pairs,
+//                                and, when mask is not 0, mask + 1 slots
+//                                of an open-addressed table of 1-based
+//                                pair indices hashed by key
+//   rootTable  rootCount node offsets
+//   keyTable   keyCount offsets of (length, bytes padded to a word)
+//
+// Offsets are from the start of the file. Node ids run from 0 to
+// nodeCount - 1 and let the reader keep one IData per node without
+// decoding anything.
+
+static const uint32_t MAGIC = 0x424c4100;   // "\0ALB" read little-endian
+static const uint32_t VERSION = 1;
+static const size_t HEADER_WORDS = 8;
+// Alists with at least this many pairs get a hash table.
+static const uint32_t HASH_THRESHOLD = 16;
+
+static uint32_t Load32(const char * p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static void Put32(string & out, uint32_t v) {
+    out.append((const char *)&v, 4);
+}
+
+static void PutBytes(string & out, const char * p, size_t n) {
+    Put32(out, (uint32_t)n);
+    out.append(p, n);
+    out.append((4 - n % 4) % 4, '\0');
+}
+
+static runtime_error Corrupt() {
+    return runtime_error("corrupt binary alist");
+}
+
+struct BinaryEncoder::State {
+    string                          nodes;
+    unordered_map<string, uint32_t> keyIndex;
+    vector<const string *>          keys;
+    vector<uint32_t>                roots;
+    uint32_t                        nodeCount;
+
+    State() : nodes(HEADER_WORDS * 4, '\0'), nodeCount(0) { }
+
+    uint32_t Offset() const {
+        if (nodes.size() > UINT32_MAX || nodeCount >= (1u << 30)) {
+            throw runtime_error("binary alist larger than 4GB");
+        }
+        return (uint32_t)nodes.size();
+    }
+
+    uint32_t Key(const Slice & key) {
+        auto it = keyIndex.emplace(string(key), (uint32_t)keys.size());
+        if (it.second) keys.push_back(&it.first->first);
+        return it.first->second;
+    }
+
+    uint32_t Scalar(IData::Type type, const Slice & s) {
+        uint32_t off = Offset();
+        Put32(nodes, nodeCount++ << 2 | type);
+        PutBytes(nodes, s.data(), s.size());
+        return off;
+    }
+
+    // words holds the item offsets followed by the (key, value) pairs.
+    uint32_t AList(size_t itemCount, const vector<uint32_t> & words) {
+        uint32_t kvCount = (uint32_t)((words.size() - itemCount) / 2);
+        uint32_t size = 0;
+        if (kvCount >= HASH_THRESHOLD) {
+            size = 32;
+            while (size < kvCount * 2) size *= 2;
+        }
+
+        uint32_t off = Offset();
+        Put32(nodes, nodeCount++ << 2 | IData::T_ALIST);
+        Put32(nodes, (uint32_t)itemCount);
+        Put32(nodes, kvCount);
+        Put32(nodes, size ? size - 1 : 0);
+        for (auto w : words) Put32(nodes, w);
+
+        if (size) {
+            // Keys are deduplicated, so equal keys have equal indices and
+            // only the first pair with a key is entered.
+            vector<uint32_t> slots(size, 0);
+            for (uint32_t i = 0; i < kvCount; ++i) {
+                uint32_t key = words[itemCount + i * 2];
+                const string & k = *keys[key];
+                uint32_t p = (uint32_t)HashBytes(k.data(), k.size()) & (size - 1);
+                while (slots[p] && words[itemCount + (slots[p] - 1) * 2] != key) {
+                    p = (p + 1) & (size - 1);
+                }
+                if (!slots[p]) slots[p] = i + 1;
+            }
+            for (auto w : slots) Put32(nodes, w);
+        }
+        return off;
+    }
+};
+
+BinaryEncoder::BinaryEncoder() : _state(new State()) { }
+
+BinaryEncoder::~BinaryEncoder() {
+    delete _state;
+}
+
+void BinaryEncoder::Add(const IData * d) {
+    // One frame per alist being written: its next child, and the words
+    // of the children written so far.
+    struct Frame {
+        const IData *       d;
+        size_t              next;
+        size_t              items;
+        size_t              size;
+        vector<uint32_t>    words;
+    };
+    vector<Frame> stack;
+
+    auto done = [&](uint32_t off) {
+        if (stack.empty()) _state->roots.push_back(off);
+        else stack.back().words.push_back(off);
+    };
+
+    // Writes a scalar or an empty alist, or pushes the frame of an alist.
+    auto begin = [&](const IData * v) {
+        if (v == nullptr) {
+            done(_state->Scalar(IData::T_UNKNOWN, Slice()));
+        }
+        else if (v->GetType() != IData::T_ALIST) {
+            done(_state->Scalar(v->GetType(), v->GetSlice()));
+        }
+        else {
+            size_t items = v->Size();
+            size_t size = items + v->KVSize();
+            if (size == 0) done(_state->AList(0, vector<uint32_t>()));
+            else stack.push_back(Frame{v, 0, items, size, vector<uint32_t>()});
+        }
+    };
+
+    begin(d);
+    while (!stack.empty()) {
+        Frame & f = stack.back();
+        if (f.next == f.size) {
+            uint32_t off = _state->AList(f.items, f.words);
+            stack.pop_back();
+            done(off);
+            continue;
+        }
+
+        size_t i = f.next++;
+        if (i < f.items) {
+            begin(f.d->At(i));
+        }
+        else {
+            f.words.push_back(_state->Key(f.d->KeyAt(i - f.items)));
+            begin(f.d->ValueAt(i - f.items));
+        }
+    }
+}
+
+void BinaryEncoder::Finish(string & out) {
+    string & nodes = _state->nodes;
+
+    uint32_t rootTable = _state->Offset();
+    for (auto r : _state->roots) Put32(nodes, r);
+
+    uint32_t keyTable = _state->Offset();
+    size_t keyCount = _state->keys.size();
+    size_t keyOff = keyTable + keyCount * 4;
+    for (auto k : _state->keys) {
+        Put32(nodes, (uint32_t)keyOff);
+        keyOff += 4 + (k->size() + 3) / 4 * 4;
+    }
+    for (auto k : _state->keys) PutBytes(nodes, k->data(), k->size());
+
+    uint32_t header[HEADER_WORDS] = {
+        MAGIC, VERSION, _state->nodeCount, (uint32_t)_state->roots.size(),
+        rootTable, (uint32_t)keyCount, keyTable, _state->Offset()
+    };
+    memcpy(&nodes[0], header, sizeof(header));
+
+    out.append(nodes);
+    delete _state;
+    _state = new State();
+}
+
+class BinaryData;
+
+// The mapped bytes, plus the IData created so far for each node id.
+class BinaryReader {
+public:
+    const char *    data;
+    size_t          size;
+    uint32_t        nodeCount;
+    uint32_t        rootCount;
+    uint32_t        rootTable;
+    uint32_t        keyCount;
+    uint32_t        keyTable;
+    // nodeCount slots, zeroed by calloc() so that the pages of the ones
+    // never used are never touched.
+    atomic<BinaryData *> * nodes;
+    mutable mutex   lock;
+
+    BinaryReader(const char * d, size_t n);
+    ~BinaryReader();
+
+    uint32_t Word(size_t off) const {
+        return Load32(data + off);
+    }
+
+    // Checks that [off, off + n) lies in the file.
+    void Check(uint64_t off, uint64_t n) const {
+        if (off % 4 != 0 || off + n > size) throw Corrupt();
+    }
+
+    const IData * Node(uint32_t off) const;
+
+    Slice Key(uint32_t i) const {
+        if (i >= keyCount) throw Corrupt();
+        uint32_t off = Word(keyTable + i * 4);
+        Check(off, 4);
+        uint32_t len = Word(off);
+        Check((uint64_t)off + 4, len);
+        return Slice(data + off + 4, len);
+    }
+};
+
+class BinaryData : public IData {
+private:
+    struct Legacy {
+        std::string str;
+        std::list<const IData *> list;
+        std::list<std::pair<std::string, const IData *>> kvList;
+    };
+
+    const BinaryReader *    _file;
+    uint32_t                _off;
+    uint32_t                _itemCount;
+    uint32_t                _kvCount;
+    uint32_t                _mask;
+    mutable std::atomic<Legacy *> _legacy;
+
+    uint32_t Word(size_t i) const {
+        return _file->Word(_off + i * 4);
+    }
+
+    // Word offsets of the item list and the pair list of an alist.
+    size_t Items() const { return 4; }
+    size_t Pairs() const { return 4 + _itemCount; }
+    size_t Slots() const { return 4 + _itemCount + _kvCount * 2; }
+
+    const Legacy * GetLegacy() const {
+        auto legacy = _legacy.load(std::memory_order_acquire);
+        if (legacy) return legacy;
+
+        std::lock_guard<std::mutex> g(_file->lock);
+        legacy = _legacy.load(std::memory_order_relaxed);
+        if (legacy) return legacy;
+
+        legacy = new Legacy();
+        if (GetType() == T_ALIST) {
+            for (uint32_t i = 0; i < _itemCount; ++i) legacy->list.push_back(At(i));
+            for (uint32_t i = 0; i < _kvCount; ++i) {
+                legacy->kvList.push_back(std::make_pair(std::string(KeyAt(i)), ValueAt(i)));
+            }
+        }
+        else {
+            legacy->str = std::string(GetSlice());
+        }
+        _legacy.store(legacy, std::memory_order_release);
+        return legacy;
+    }
+
+public:
+    BinaryData(const BinaryReader * file, uint32_t off)
+        : _file(file)
+        , _off(off)
+        , _itemCount(0)
+        , _kvCount(0)
+        , _mask(0)
+        , _legacy(nullptr) {
+        if (GetType() == T_ALIST) {
+            _file->Check(off, 16);
+            _itemCount = Word(1);
+            _kvCount = Word(2);
+            _mask = Word(3);
+            if (_mask & (_mask + 1)) throw Corrupt();
+            _file->Check(off, ((uint64_t)Slots() + (_mask ? _mask + 1 : 0)) * 4);
+        }
+        else {
+            _file->Check(off, 8);
+            _file->Check((uint64_t)off + 8, Word(1));
+        }
+    }
+
+    ~BinaryData() override {
+        delete _legacy.load();
+    }
+
+    Type GetType() const override {
+        return (Type)(Word(0) & 3);
+    }
+
+    Slice GetSlice() const override {
+        if (GetType() == T_ALIST) return Slice();
+        return Slice(_file->data + _off + 8, Word(1));
+    }
+
+    const std::string & GetString() const override {
+        return GetLegacy()->str;
+    }
+
+    const std::list<const IData *> & GetList() const override {
+        return GetLegacy()->list;
+    }
+
+    const std::list<std::pair<std::string, const IData *>> & GetKVList() const override {
+        return GetLegacy()->kvList;
+    }
+
+    size_t Size() const override {
+        return _itemCount;
+    }
+
+    const IData * At(size_t i) const override {
+        return i < _itemCount ? _file->Node(Word(Items() + i)) : nullptr;
+    }
+
+    size_t KVSize() const override {
+        return _kvCount;
+    }
+
+    Slice KeyAt(size_t i) const override {
+        return i < _kvCount ? _file->Key(Word(Pairs() + i * 2)) : Slice();
+    }
+
+    const IData * ValueAt(size_t i) const override {
+        return i < _kvCount ? _file->Node(Word(Pairs() + i * 2 + 1)) : nullptr;
+    }
+
+    const IData * Find(const Slice & key) const override {
+        if (_mask == 0) {
+            for (uint32_t i = 0; i < _kvCount; ++i) {
+                if (KeyAt(i) == key) return ValueAt(i);
+            }
+            return nullptr;
+        }
+
+        uint32_t p = (uint32_t)HashBytes(key.data(), key.size()) & _mask;
+        for (uint32_t n = 0; n <= _mask; ++n) {
+            uint32_t slot = Word(Slots() + p);
+            if (slot == 0 || slot > _kvCount) break;
+            if (KeyAt(slot - 1) == key) return ValueAt(slot - 1);
+            p = (p + 1) & _mask;
+        }
+        return nullptr;
+    }
+};
+
+BinaryReader::BinaryReader(const char * d, size_t n)
+    : data(d), size(n), nodes(nullptr) {
+    if ((uintptr_t)d % 4 != 0) throw runtime_error("binary alist must be 4-byte aligned");
+    Check(0, HEADER_WORDS * 4);
+    if (Word(0) != MAGIC) throw runtime_error("not a binary alist");
+    if (Word(4) != VERSION) throw runtime_error("unsupported binary alist version");
+    nodeCount = Word(8);
+    rootCount = Word(12);
+    rootTable = Word(16);
+    keyCount = Word(20);
+    keyTable = Word(24);
+    if (Word(28) != n) throw Corrupt();
+    Check(rootTable, (uint64_t)rootCount * 4);
+    Check(keyTable, (uint64_t)keyCount * 4);
+
+    nodes = (atomic<BinaryData *> *)calloc(nodeCount ? nodeCount : 1, sizeof(atomic<BinaryData *>));
+    if (nodes == nullptr) throw bad_alloc();
+}
+
+BinaryReader::~BinaryReader() {
+    for (uint32_t i = 0; i < nodeCount; ++i) {
+        delete nodes[i].load(memory_order_relaxed);
+    }
+    free(nodes);
+}
+
+const IData * BinaryReader::Node(uint32_t off) const {
+    Check(off, 4);
+    uint32_t id = Word(off) >> 2;
+    if (id >= nodeCount) throw Corrupt();
+
+    auto && slot = nodes[id];
+    auto d = slot.load(memory_order_acquire);
+    if (d) return d;
+
+    // Racing readers may both build the node; the loser's copy is dropped.
+    auto fresh = new BinaryData(this, off);
+    if (slot.compare_exchange_strong(d, fresh, memory_order_acq_rel)) return fresh;
+    delete fresh;
+    return d;
+}
+
+struct BinaryDocument::State {
+    MappedFile *    file;
+    BinaryReader    reader;
+
+    explicit State(MappedFile * f) : file(f), reader(f->Data(), f->Size()) { }
+    State(const char * data, size_t size) : file(nullptr), reader(data, size) { }
+    ~State() { delete file; }
+};
+
+BinaryDocument::BinaryDocument(const char * path) : _state(nullptr) {
+    auto file = new MappedFile(path);
+    try {
+        _state = new State(file);
+    }
+    catch (...) {
+        delete file;
+        throw;
+    }
+}
+
+BinaryDocument::BinaryDocument(const char * data, size_t size)
+    : _state(new State(data, size)) { }
+
+BinaryDocument::~BinaryDocument() {
+    delete _state;
+}
+
+size_t BinaryDocument::Size() const {
+    return _state->reader.rootCount;
+}
+
+const IData * BinaryDocument::At(size_t i) const {
+    if (i >= Size()) return nullptr;
+    auto && r = _state->reader;
+    return r.Node(r.Word(r.rootTable + i * 4));
+}
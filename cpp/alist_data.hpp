@@ -0,0 +1,1288 @@
+#ifndef __ALIST_DATA__
+#define __ALIST_DATA__
+
+#include "alist.hpp"
+#include <string>
+#include <list>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+namespace alist {
+
+    // Bump allocator backing one parsed document. Nodes, string payloads
+    // and child arrays are carved out of a chain of blocks and released
+    // together when the arena is deleted; nothing allocated here has its
+    // destructor run unless it is registered through Own().
+    class Arena {
+    private:
+        struct Block {
+            Block * next;
+            size_t  size;
+            size_t  used;
+        };
+
+        struct Cleanup {
+            Cleanup * next;
+            void *    obj;
+            void   (* destroy)(void *);
+        };
+
+        static const size_t FIRST_BLOCK_SIZE = 512;
+        static const size_t MAX_BLOCK_SIZE = 64 * 1024;
+
+        Block *    _head;
+        Cleanup *  _cleanups;
+        void *     _last;
+        size_t     _firstBlockSize;
+        size_t     _nextBlockSize;
+        size_t     _bytes;
+        std::mutex _lock;
+        // KeyTable the keys of this arena's alists were interned in.
+        const void * _keys;
+
+        static size_t AlignUp(size_t v, size_t a) {
+            return (v + a - 1) & ~(a - 1);
+        }
+
+        static size_t ClampBlockSize(size_t v) {
+            return v < 64 ? 64 : v > MAX_BLOCK_SIZE ? MAX_BLOCK_SIZE : v;
+        }
+
+        static char * Payload(Block * b) {
+            return (char *)b + AlignUp(sizeof(Block), alignof(std::max_align_t));
+        }
+
+        Block * NewBlock(size_t minSize) {
+            size_t size = _nextBlockSize;
+            if (minSize > size / 2) {
+                // Oversized requests get a dedicated block so they do not
+                // waste the tail of the current one.
+                size = minSize;
+            }
+            else if (_nextBlockSize < MAX_BLOCK_SIZE) {
+                // After a larger first block, growth restarts from the
+                // default size, so a first block sized too small costs
+                // little.
+                if (!_head && _nextBlockSize > FIRST_BLOCK_SIZE) _nextBlockSize = FIRST_BLOCK_SIZE;
+                _nextBlockSize *= 2;
+            }
+
+            size_t header = AlignUp(sizeof(Block), alignof(std::max_align_t));
+            auto b = (Block *)::operator new(header + size);
+            b->size = size;
+            b->used = 0;
+            _bytes += header + size;
+
+            if (_head && size == minSize && _head->used < _head->size) {
+                // Keep bumping into the partially used block.
+                b->next = _head->next;
+                _head->next = b;
+            }
+            else {
+                b->next = _head;
+                _head = b;
+            }
+            return b;
+        }
+
+    public:
+        // firstBlockSize is kept between 64 bytes and MAX_BLOCK_SIZE; later
+        // blocks double from it or FIRST_BLOCK_SIZE, whichever is smaller.
+        explicit Arena(size_t firstBlockSize = FIRST_BLOCK_SIZE)
+            : _head(nullptr)
+            , _cleanups(nullptr)
+            , _last(nullptr)
+            , _firstBlockSize(ClampBlockSize(firstBlockSize))
+            , _nextBlockSize(_firstBlockSize)
+            , _bytes(0)
+            , _keys(nullptr)
+            { }
+
+        Arena(const Arena &) = delete;
+        Arena & operator=(const Arena &) = delete;
+
+        ~Arena() {
+            Clear();
+        }
+
+        void Clear() {
+            while (_cleanups) {
+                auto c = _cleanups;
+                _cleanups = c->next;
+                c->destroy(c->obj);
+                delete c;
+            }
+            while (_head) {
+                auto b = _head;
+                _head = b->next;
+                ::operator delete(b);
+            }
+            _last = nullptr;
+            _nextBlockSize = _firstBlockSize;
+            _bytes = 0;
+        }
+
+        void * Alloc(size_t size, size_t align = alignof(void *)) {
+            if (_head) {
+                size_t off = AlignUp(_head->used, align);
+                if (off + size <= _head->size) {
+                    _head->used = off + size;
+                    return _last = Payload(_head) + off;
+                }
+            }
+
+            auto b = NewBlock(size);
+            b->used = size;
+            return _last = Payload(b);
+        }
+
+        // Resizes the most recent allocation in place when possible,
+        // otherwise copies it to a fresh allocation. The old bytes stay
+        // in the arena until it is freed.
+        void * Grow(void * p, size_t oldSize, size_t newSize, size_t align = alignof(void *)) {
+            if (p && p == _last && _head &&
+                (char *)p >= Payload(_head) && (char *)p < Payload(_head) + _head->size) {
+                size_t off = (char *)p - Payload(_head);
+                if (off + newSize <= _head->size) {
+                    _head->used = off + newSize;
+                    return p;
+                }
+            }
+
+            void * n = Alloc(newSize, align);
+            if (oldSize) memcpy(n, p, oldSize);
+            return n;
+        }
+
+        // Where the next allocation goes, for Rewind().
+        struct Mark {
+            Block * block;
+            size_t  used;
+        };
+
+        Mark GetMark() const {
+            return Mark{_head, _head ? _head->used : 0};
+        }
+
+        // Takes back what was allocated since m, if it all went into the
+        // block current at the time, and returns whether it did; otherwise
+        // does nothing. None of it may be used again, though its bytes
+        // stay as they are until the next allocation.
+        bool Rewind(const Mark & m) {
+            if (m.block && m.block == _head) {
+                _head->used = m.used;
+                _last = nullptr;
+                return true;
+            }
+            return false;
+        }
+
+        char * CopyBytes(const char * s, size_t len) {
+            auto r = (char *)Alloc(len ? len : 1, 1);
+            if (len) memcpy(r, s, len);
+            return r;
+        }
+
+        template<typename T, typename... Args>
+        T * New(Args &&... args) {
+            return new (Alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        // Registers a heap object to be deleted together with the arena.
+        template<typename T>
+        T * Own(T * obj) {
+            auto c = new Cleanup();
+            c->obj = obj;
+            c->destroy = [](void * o) { delete (T *)o; };
+            c->next = _cleanups;
+            _cleanups = c;
+            return obj;
+        }
+
+        // Serializes lazy work done on a finished document by concurrent
+        // readers (which may allocate from the arena or call Own()).
+        std::mutex & Lock() { return _lock; }
+
+        // Bytes reserved from the system allocator, including block headers.
+        size_t Bytes() const { return _bytes; }
+
+        // Bytes handed out from the blocks, including alignment padding.
+        size_t Used() const {
+            size_t used = 0;
+            for (auto b = _head; b; b = b->next) used += b->used;
+            return used;
+        }
+
+        const void * Keys() const { return _keys; }
+        void SetKeys(const void * keys) { _keys = keys; }
+    };
+
+    // arr, holding count elements out of cap, or a larger copy of it if
+    // it is full.
+    template<typename T>
+    inline T * GrowArray(Arena * a, T * arr, uint32_t count, uint32_t & cap) {
+        if (count < cap) return arr;
+        uint32_t n = cap ? cap * 2 : 4;
+        arr = (T *)a->Grow(arr, sizeof(T) * count, sizeof(T) * n, alignof(T));
+        cap = n;
+        return arr;
+    }
+
+    // 64-bit FNV-1a.
+    inline uint64_t HashBytes(const char * s, size_t len) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < len; ++i) {
+            h ^= (unsigned char)s[i];
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    // Steps of the structural hash IData::Hash() computes. A scalar hashes
+    // its type and text; an alist its sizes, then the hash of each item,
+    // then the key text and value hash of each pair. A missing child
+    // hashes as 0. HashFinish() keeps 0 free to mean "not computed".
+    inline uint64_t HashCombine(uint64_t h, uint64_t v) {
+        h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    inline uint64_t HashScalar(IData::Type type, const Slice & s) {
+        return HashCombine(type, HashBytes(s.data(), s.size()));
+    }
+
+    inline uint64_t HashAList(size_t items, size_t kvs) {
+        return HashCombine(HashCombine(IData::T_ALIST, items), kvs);
+    }
+
+    inline uint64_t HashFinish(uint64_t h) {
+        return h ? h : 1;
+    }
+
+    // A pair of an alist. The key text is in the arena of the alist, in
+    // the input it was parsed from if that is stable, or in the KeyTable
+    // it was interned in, whose keys are compared by address.
+    struct DataKV {
+        const char *  key;
+        uint32_t      keyLen;
+        const IData * value;
+
+        Slice Key() const { return Slice(key, keyLen); }
+
+        void SetKey(const Slice & k) {
+            key = k.data();
+            keyLen = (uint32_t)k.size();
+        }
+    };
+
+    // Tree node produced by ParseOperator. All nodes of a document live in
+    // its arena; only the document root is a heap object, and it owns the
+    // arena, so deleting the root releases the whole tree at once.
+    class Data : public IData {
+    private:
+        // std containers for the list/string based IData accessors, built
+        // on first use and owned by the arena.
+        struct Legacy {
+            std::string str;
+            std::list<const IData *> list;
+            std::list<std::pair<std::string, const IData *>> kvList;
+        };
+
+        Type            _type;
+        bool            _ownsArena;
+        // Set on literals decoded when they were parsed, whose kind is
+        // _kind and whose value is in the union below.
+        bool            _decoded;
+        uint8_t         _kind;
+        // Set on a document root that took its arrays from a shared node;
+        // they are copied before the root is changed.
+        bool            _borrowedArrays;
+        uint32_t        _strLen;
+        uint32_t        _strCap;
+        uint32_t        _itemCount;
+        uint32_t        _itemCap;
+        uint32_t        _kvCount;
+        uint32_t        _kvCap;
+        const char *    _str;
+        union {
+            const IData ** _items;
+            int64_t        _int;
+            double         _float;
+        };
+        DataKV *        _kvs;
+        Arena *         _arena;
+        mutable std::atomic<Legacy *> _legacy;
+        // Open-addressed table of 1-based _kvs indices, built by the first
+        // Find() on an alist with at least HASH_THRESHOLD pairs. Slot 0
+        // holds the mask.
+        mutable std::atomic<uint32_t *> _index;
+        // IData::Hash(), or 0 until it is computed.
+        mutable std::atomic<uint64_t> _hash;
+
+        static const uint32_t HASH_THRESHOLD = 16;
+
+        friend class ParseOperator;
+        friend class LazyData;
+        friend class KeyTable;
+        friend class SubtreeTable;
+        friend class TreeEditor;
+
+        void CopyContent(const Data & o) {
+            _type = o._type;
+            _decoded = o._decoded;
+            _kind = o._kind;
+            _strLen = o._strLen;
+            _strCap = o._strCap;
+            _itemCount = o._itemCount;
+            _itemCap = o._itemCap;
+            _kvCount = o._kvCount;
+            _kvCap = o._kvCap;
+            _str = o._str;
+            // Whichever member of the union is in use.
+            memcpy((void *)&_int, (const void *)&o._int, sizeof(_int));
+            _kvs = o._kvs;
+            _hash.store(o._hash.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+
+        Slice KeySlice(uint32_t i) const {
+            return _kvs[i].Key();
+        }
+
+        const uint32_t * GetIndex() const {
+            auto idx = _index.load(std::memory_order_acquire);
+            if (idx) return idx;
+
+            std::lock_guard<std::mutex> g(_arena->Lock());
+            idx = _index.load(std::memory_order_relaxed);
+            if (idx) return idx;
+
+            uint32_t size = 32;
+            while (size < _kvCount * 2) size *= 2;
+            idx = (uint32_t *)_arena->Alloc(sizeof(uint32_t) * (size + 1), alignof(uint32_t));
+            memset(idx, 0, sizeof(uint32_t) * (size + 1));
+            idx[0] = size - 1;
+            uint32_t * slots = idx + 1;
+            for (uint32_t i = 0; i < _kvCount; ++i) {
+                Slice k = KeySlice(i);
+                uint32_t p = (uint32_t)HashBytes(k.data(), k.size()) & idx[0];
+                while (slots[p] && KeySlice(slots[p] - 1) != k) p = (p + 1) & idx[0];
+                // Only the first pair with a key is reachable through Find().
+                if (!slots[p]) slots[p] = i + 1;
+            }
+
+            _index.store(idx, std::memory_order_release);
+            return idx;
+        }
+
+        const Legacy * GetLegacy() const {
+            auto l = _legacy.load(std::memory_order_acquire);
+            if (l) return l;
+
+            std::lock_guard<std::mutex> g(_arena->Lock());
+            l = _legacy.load(std::memory_order_relaxed);
+            if (l) return l;
+
+            l = new Legacy();
+            if (_str) l->str.assign(_str, _strLen);
+            for (uint32_t i = 0; i < _itemCount; ++i) {
+                l->list.push_back(_items[i]);
+            }
+            for (uint32_t i = 0; i < _kvCount; ++i) {
+                l->kvList.push_back(std::make_pair(
+                    std::string(KeySlice(i)), _kvs[i].value));
+            }
+
+            _arena->Own(l);
+            _legacy.store(l, std::memory_order_release);
+            return l;
+        }
+
+    public:
+        explicit Data(Arena * arena, Type type = T_UNKNOWN)
+            : _type(type)
+            , _ownsArena(false)
+            , _decoded(false)
+            , _kind(K_NONE)
+            , _borrowedArrays(false)
+            , _strLen(0)
+            , _strCap(0)
+            , _itemCount(0)
+            , _itemCap(0)
+            , _kvCount(0)
+            , _kvCap(0)
+            , _str(nullptr)
+            , _items(nullptr)
+            , _kvs(nullptr)
+            , _arena(arena)
+            , _legacy(nullptr)
+            , _index(nullptr)
+            , _hash(0)
+            { }
+
+        Type GetType() const override {
+            return _type;
+        }
+
+        const std::string & GetString() const override {
+            return GetLegacy()->str;
+        }
+
+        Slice GetSlice() const override {
+            return _str ? Slice(_str, _strLen) : Slice();
+        }
+
+        bool CachedHash(uint64_t & h) const override {
+            h = _hash.load(std::memory_order_relaxed);
+            return h != 0;
+        }
+
+        void CacheHash(uint64_t h) const override {
+            _hash.store(h, std::memory_order_relaxed);
+        }
+
+        Scalar GetScalar() const override {
+            if (!_decoded) return IData::GetScalar();
+            Scalar s;
+            s.kind = (Kind)_kind;
+            if (s.kind == K_FLOAT) s.f = _float;
+            else if (s.kind == K_BOOL) s.b = _int != 0;
+            else s.i = _int;
+            return s;
+        }
+
+        const std::list<const IData *> & GetList() const override {
+            return GetLegacy()->list;
+        }
+
+        const std::list<std::pair<std::string, const IData *>> & GetKVList() const override {
+            return GetLegacy()->kvList;
+        }
+
+        size_t Size() const override {
+            return _itemCount;
+        }
+
+        const IData * At(size_t i) const override {
+            return i < _itemCount ? _items[i] : nullptr;
+        }
+
+        size_t KVSize() const override {
+            return _kvCount;
+        }
+
+        Slice KeyAt(size_t i) const override {
+            return i < _kvCount ? KeySlice(i) : Slice();
+        }
+
+        const IData * ValueAt(size_t i) const override {
+            return i < _kvCount ? _kvs[i].value : nullptr;
+        }
+
+        const IData * Find(const Slice & key) const override {
+            if (_kvCount < HASH_THRESHOLD) {
+                for (uint32_t i = 0; i < _kvCount; ++i) {
+                    if (KeySlice(i) == key) return _kvs[i].value;
+                }
+                return nullptr;
+            }
+
+            auto idx = GetIndex();
+            const uint32_t * slots = idx + 1;
+            uint32_t p = (uint32_t)HashBytes(key.data(), key.size()) & idx[0];
+            while (slots[p]) {
+                if (KeySlice(slots[p] - 1) == key) return _kvs[slots[p] - 1].value;
+                p = (p + 1) & idx[0];
+            }
+            return nullptr;
+        }
+
+        // Keys interned in the same table share their text, so they are
+        // matched by address; the hash was computed when it was interned.
+        const IData * FindKey(const Key & key) const override {
+            if (_arena->Keys() != key._table) return Find(key._text);
+            if (_kvCount < HASH_THRESHOLD) {
+                for (uint32_t i = 0; i < _kvCount; ++i) {
+                    if (_kvs[i].key == key._text.data()) return _kvs[i].value;
+                }
+                return nullptr;
+            }
+
+            auto idx = GetIndex();
+            const uint32_t * slots = idx + 1;
+            uint32_t p = (uint32_t)key._hash & idx[0];
+            while (slots[p]) {
+                if (_kvs[slots[p] - 1].key == key._text.data()) return _kvs[slots[p] - 1].value;
+                p = (p + 1) & idx[0];
+            }
+            return nullptr;
+        }
+
+        // Puts the document root now in the place of the child old, and
+        // hands now to this node's arena to be deleted with it. Views from
+        // GetList() and GetKVList() are dropped from the cache (they stay
+        // allocated until the arena goes) so the next call sees the change.
+        // Must not race with readers of this node.
+        bool ReplaceChild(const IData * old, Data * now) {
+            bool found = false;
+            for (uint32_t i = 0; i < _itemCount && !found; ++i) {
+                if (_items[i] == old) {
+                    _items[i] = now;
+                    found = true;
+                }
+            }
+            for (uint32_t i = 0; i < _kvCount && !found; ++i) {
+                if (_kvs[i].value == old) {
+                    _kvs[i].value = now;
+                    found = true;
+                }
+            }
+            if (!found) return false;
+
+            _arena->Own(now);
+            _legacy.store(nullptr, std::memory_order_release);
+            return true;
+        }
+
+        ~Data() override {
+            // Only document roots are ever destroyed; they take the arena
+            // (and every node in it) with them.
+            if (_ownsArena) delete _arena;
+        }
+    };
+
+    // Parses the text of lazy alists; see LazyData.
+    class Expander {
+    public:
+        virtual ~Expander() = default;
+        // Parses the alist in s[0..len) into nodes allocated from arena
+        // and returns it. Throws ParseException.
+        virtual Data * Parse(Arena * arena, const char * s, size_t len) const = 0;
+    };
+
+    // Nested alist built by a lazy parser. It holds only its text until
+    // one of the accessors needs its content; the first of them parses
+    // the text into this node, whose own nested alists are lazy in turn.
+    // A syntax error in the text is thrown from that call, and again from
+    // later ones.
+    class LazyData final : public Data {
+    private:
+        const char *        _text;
+        size_t              _textLen;
+        const Expander *    _expander;
+        mutable std::atomic<bool> _expanded;
+
+        void Expand() const {
+            if (_expanded.load(std::memory_order_acquire)) return;
+
+            std::lock_guard<std::mutex> g(_arena->Lock());
+            if (_expanded.load(std::memory_order_relaxed)) return;
+            auto d = _expander->Parse(_arena, _text, _textLen);
+            const_cast<LazyData *>(this)->CopyContent(*d);
+            _expanded.store(true, std::memory_order_release);
+        }
+
+    public:
+        LazyData(Arena * arena, const char * text, size_t len, const Expander * expander)
+            : Data(arena, T_ALIST)
+            , _text(text)
+            , _textLen(len)
+            , _expander(expander)
+            , _expanded(false)
+            { }
+
+        // Known without expanding, and not read from the fields Expand()
+        // writes.
+        Type GetType() const override {
+            return T_ALIST;
+        }
+
+        const std::string & GetString() const override {
+            Expand();
+            return Data::GetString();
+        }
+
+        Slice GetSlice() const override {
+            return Slice();
+        }
+
+        const std::list<const IData *> & GetList() const override {
+            Expand();
+            return Data::GetList();
+        }
+
+        const std::list<std::pair<std::string, const IData *>> & GetKVList() const override {
+            Expand();
+            return Data::GetKVList();
+        }
+
+        size_t Size() const override {
+            Expand();
+            return Data::Size();
+        }
+
+        const IData * At(size_t i) const override {
+            Expand();
+            return Data::At(i);
+        }
+
+        size_t KVSize() const override {
+            Expand();
+            return Data::KVSize();
+        }
+
+        Slice KeyAt(size_t i) const override {
+            Expand();
+            return Data::KeyAt(i);
+        }
+
+        const IData * ValueAt(size_t i) const override {
+            Expand();
+            return Data::ValueAt(i);
+        }
+
+        const IData * Find(const Slice & key) const override {
+            Expand();
+            return Data::Find(key);
+        }
+
+        const IData * FindKey(const Key & key) const override {
+            Expand();
+            return Data::FindKey(key);
+        }
+    };
+
+    // Default IOperator. Builds Data trees in one arena per top-level
+    // document; DocumentFinalize hands the arena over to the root.
+    class ParseOperator final : public IOperator {
+    private:
+        Arena * _arena;
+        // First block for the next document's arena: a running average of
+        // what recent ones used, so that a run of similar documents each
+        // fit one block; 0 until a document is finished.
+        size_t  _firstBlock;
+        // Set when building into the arena of a document being expanded,
+        // which stays with that document.
+        bool    _borrowed;
+        // Decode literals as they are read.
+        bool    _typed;
+        // Parses the LazyData built, if any. Every document holds a
+        // reference to it through its arena.
+        std::shared_ptr<const Expander> _expander;
+        const Expander * _lazy;
+        // Table keys are interned in, if any, with the keys this parser
+        // looked up last by hash.
+        std::shared_ptr<KeyTable::State> _keys;
+        struct CachedKey {
+            uint64_t    hash;
+            const Key * key;
+        };
+        static const size_t KEY_CACHE_SIZE = 64;
+        CachedKey _keyCache[KEY_CACHE_SIZE];
+        // Table subtrees are shared through, if any; once an alist is
+        // complete, all it took since its mark is given back.
+        std::shared_ptr<SubtreeTable::State> _trees;
+        // Alists being built, one inside the next, with the children they
+        // have so far. AListFinalize() gives each arrays of the size it
+        // needs, so growing them leaves nothing behind in the arena. The
+        // first _depth are in use; the rest keep their capacity.
+        struct Open {
+            Arena::Mark                 mark;
+            std::vector<const IData *>  items;
+            std::vector<DataKV>         kvs;
+        };
+        std::vector<Open> _open;
+        size_t _depth;
+        // Latest scalar, and where the arena stood before it, while
+        // nothing else has been allocated since; if it turns out to be a
+        // key, its node is taken back.
+        Data * _scalar;
+        Arena::Mark _scalarMark;
+
+        Arena * CurArena() {
+            if (_arena == nullptr) {
+                _arena = _firstBlock ? new Arena(_firstBlock) : new Arena();
+                if (_expander) _arena->Own(new std::shared_ptr<const Expander>(_expander));
+                if (_keys) {
+                    _arena->Own(new std::shared_ptr<KeyTable::State>(_keys));
+                    _arena->SetKeys(_keys.get());
+                }
+                if (_trees) _arena->Own(new std::shared_ptr<SubtreeTable::State>(_trees));
+            }
+            return _arena;
+        }
+
+        Data * NewScalar(Data::Type type) {
+            auto m = CurArena()->GetMark();
+            _scalar = _arena->New<Data>(_arena, type);
+            _scalarMark = m;
+            return _scalar;
+        }
+
+        void Reserve(Data * d, size_t need) {
+            if (need > d->_strCap) {
+                size_t cap = d->_strCap ? d->_strCap * 2 : 16;
+                while (cap < need) cap *= 2;
+                d->_str = (const char *)d->_arena->Grow(
+                    (void *)d->_str, d->_strLen, cap, 1);
+                d->_strCap = cap;
+            }
+        }
+
+        void Append(Data * d, const char * s, size_t len) {
+            if (len == 0) return;
+            Reserve(d, (size_t)d->_strLen + len);
+            memcpy((char *)d->_str + d->_strLen, s, len);
+            d->_strLen += len;
+        }
+
+        static void Decode(Data * d) {
+            auto s = IData::Decode(Slice(d->_str, d->_strLen));
+            d->_decoded = true;
+            d->_kind = s.kind;
+            if (s.kind == IData::K_FLOAT) d->_float = s.f;
+            else if (s.kind == IData::K_BOOL) d->_int = s.b;
+            else d->_int = s.i;
+        }
+
+        // Swaps d, complete and built since m, for the table's node with
+        // the same content.
+        Data * Share(Data * d, const Arena::Mark & m) {
+            uint64_t h;
+            if (d->_type == Data::T_ALIST) {
+                h = HashAList(d->_itemCount, d->_kvCount);
+                for (uint32_t i = 0; i < d->_itemCount; ++i) {
+                    h = HashCombine(h, ((const Data *)d->_items[i])->_hash.load(std::memory_order_relaxed));
+                }
+                for (uint32_t i = 0; i < d->_kvCount; ++i) {
+                    Slice k = d->KeySlice(i);
+                    h = HashCombine(h, HashBytes(k.data(), k.size()));
+                    h = HashCombine(h, ((const Data *)d->_kvs[i].value)->_hash.load(std::memory_order_relaxed));
+                }
+            }
+            else {
+                h = HashScalar(d->_type, d->GetSlice());
+            }
+            d->_hash.store(HashFinish(h), std::memory_order_relaxed);
+            auto n = SubtreeTable::Intern(*_trees, d);
+            _arena->Rewind(m);
+            _scalar = nullptr;
+            return (Data *)n;
+        }
+
+    public:
+        ParseOperator()
+            : _arena(nullptr), _firstBlock(0), _borrowed(false), _typed(false), _lazy(nullptr)
+            , _depth(0), _scalar(nullptr) { }
+
+        // Builds nested alists handed to AListLazy() as LazyData.
+        explicit ParseOperator(std::shared_ptr<const Expander> expander)
+            : _arena(nullptr), _firstBlock(0), _borrowed(false), _typed(false), _expander(expander)
+            , _lazy(expander.get()), _depth(0), _scalar(nullptr) { }
+
+        // Builds into arena, for expander; documents are not copied out.
+        ParseOperator(Arena * arena, const Expander * expander)
+            : _arena(arena), _firstBlock(0), _borrowed(true), _typed(false), _lazy(expander)
+            , _depth(0), _scalar(nullptr) { }
+
+        // Stores keys as the text interned for them in keys.
+        explicit ParseOperator(KeyTable & keys)
+            : _arena(nullptr), _firstBlock(0), _borrowed(false), _typed(false), _lazy(nullptr)
+            , _keys(keys._state), _keyCache(), _depth(0), _scalar(nullptr) { }
+
+        // Decodes literals as they are read when typed is set.
+        explicit ParseOperator(bool typed)
+            : _arena(nullptr), _firstBlock(0), _borrowed(false), _typed(typed), _lazy(nullptr)
+            , _depth(0), _scalar(nullptr) { }
+
+        // Shares subtrees through trees.
+        explicit ParseOperator(SubtreeTable & trees)
+            : _arena(nullptr), _firstBlock(0), _borrowed(false), _typed(false), _lazy(nullptr)
+            , _trees(trees._state), _depth(0), _scalar(nullptr) { }
+
+        ParseOperator(const ParseOperator &) = delete;
+        ParseOperator & operator=(const ParseOperator &) = delete;
+
+        ~ParseOperator() override {
+            if (!_borrowed) delete _arena;
+        }
+
+        void * AListNew() override {
+            _scalar = nullptr;
+            if (_depth == _open.size()) _open.emplace_back();
+            auto && o = _open[_depth++];
+            o.mark = CurArena()->GetMark();
+            o.items.clear();
+            o.kvs.clear();
+            return _arena->New<Data>(_arena, Data::T_ALIST);
+        }
+
+        void * AListAppendItem(void * d, void * i) override {
+            _scalar = nullptr;
+            _open[_depth - 1].items.push_back((Data *)i);
+            return d;
+        }
+
+        // Starts a pair of d with the text of key, and returns d to stand
+        // for the key until AListAppendKV() ends the pair. The node of key
+        // is taken back if nothing has been allocated since it, and text
+        // it copied moved down in its place.
+        void * AListKey(void * d, void * key, bool /*isLiteral*/) override {
+            auto k = (Data *)key;
+            Slice s = k->GetSlice();
+            if (_keys) {
+                uint64_t hash = HashBytes(s.data(), s.size());
+                auto && c = _keyCache[hash % KEY_CACHE_SIZE];
+                if (c.key == nullptr || c.hash != hash || c.key->_text != s) {
+                    c.hash = hash;
+                    c.key = KeyTable::Intern(*_keys, s, hash);
+                }
+                if (k == _scalar) _arena->Rewind(_scalarMark);
+                s = c.key->_text;
+            }
+            else if (k == _scalar) {
+                // Text borrowed from a stable input stays where it is.
+                bool copied = k->_strCap != 0;
+                if (_arena->Rewind(_scalarMark) && copied) {
+                    auto t = (char *)_arena->Alloc(s.size() ? s.size() : 1, 1);
+                    memmove(t, s.data(), s.size());
+                    s = Slice(t, s.size());
+                }
+            }
+            _scalar = nullptr;
+            DataKV kv;
+            kv.SetKey(s);
+            kv.value = nullptr;
+            _open[_depth - 1].kvs.push_back(kv);
+            return d;
+        }
+
+        // Ends the pair AListKey() started.
+        void * AListAppendKV(void * d, void * /*k*/, bool /*isLiteral*/, void * v) override {
+            _scalar = nullptr;
+            _open[_depth - 1].kvs.back().value = (Data *)v;
+            return d;
+        }
+
+        void * AListFinalize(void * _d) override {
+            _scalar = nullptr;
+            auto && o = _open[--_depth];
+            auto d = (Data *)_d;
+            if (!o.items.empty()) {
+                d->_itemCount = d->_itemCap = (uint32_t)o.items.size();
+                d->_items = (const IData **)_arena->Alloc(sizeof(const IData *) * d->_itemCount,
+                                                          alignof(const IData *));
+                memcpy(d->_items, o.items.data(), sizeof(const IData *) * d->_itemCount);
+            }
+            if (!o.kvs.empty()) {
+                d->_kvCount = d->_kvCap = (uint32_t)o.kvs.size();
+                d->_kvs = (DataKV *)_arena->Alloc(sizeof(DataKV) * d->_kvCount, alignof(DataKV));
+                memcpy(d->_kvs, o.kvs.data(), sizeof(DataKV) * d->_kvCount);
+            }
+            if (!_trees) return d;
+            return Share(d, o.mark);
+        }
+
+        void * AListLazy(const char * s, size_t len, bool copy) override {
+            if (_lazy == nullptr) return nullptr;
+            _scalar = nullptr;
+            auto a = CurArena();
+            return a->New<LazyData>(a, copy ? a->CopyBytes(s, len) : s, len, _lazy);
+        }
+
+        void * StringNew() override {
+            return NewScalar(Data::T_STRING);
+        }
+
+        void * StringAppendByte(void * _d, unsigned char b) override {
+            auto d = (Data *)_d;
+            char c = (char)b;
+            Append(d, &c, 1);
+            return d;
+        }
+
+        void * StringAppendByteArray(void * _d, const unsigned char * ba, int len) override {
+            auto d = (Data *)_d;
+            Append(d, (const char *)ba, len);
+            return d;
+        }
+
+        void * StringAppendRef(void * _d, const unsigned char * ba, int len) override {
+            auto d = (Data *)_d;
+            if (d->_strLen == 0) {
+                // Borrow the bytes; a capacity of 0 makes any later
+                // append copy them into the arena first.
+                d->_str = (const char *)ba;
+                d->_strLen = len;
+                d->_strCap = 0;
+            }
+            else if (d->_strCap == 0 && (const char *)ba == d->_str + d->_strLen) {
+                d->_strLen += len;
+            }
+            else {
+                Append(d, (const char *)ba, len);
+            }
+            return d;
+        }
+
+        void * StringReserve(void * _d, size_t n) override {
+            auto d = (Data *)_d;
+            Reserve(d, (size_t)d->_strLen + n);
+            return d;
+        }
+
+        void * StringFinalize(void * d) override {
+            if (_trees && d == _scalar) return Share(_scalar, _scalarMark);
+            return d;
+        }
+
+        void * LiteralNew(const char * s, int len) override {
+            auto ret = NewScalar(Data::T_LITERAL);
+            ret->_str = _arena->CopyBytes(s, len);
+            ret->_strLen = len;
+            ret->_strCap = len;
+            if (_typed) Decode(ret);
+            if (_trees) return Share(ret, _scalarMark);
+            return ret;
+        }
+
+        void * LiteralRef(const char * s, int len) override {
+            auto ret = NewScalar(Data::T_LITERAL);
+            ret->_str = s;
+            ret->_strLen = len;
+            if (_typed) Decode(ret);
+            if (_trees) return Share(ret, _scalarMark);
+            return ret;
+        }
+
+        void * DocumentFinalize(void * _d) override {
+            if (_borrowed) return _d;
+            auto d = (Data *)_d;
+            // With a SubtreeTable the arena ends up holding little more
+            // than the root, but nodes are only given back while they
+            // fit the current block, so it keeps the default size.
+            if (!_trees) {
+                size_t used = _arena->Used();
+                if (_firstBlock) used = (_firstBlock * 3 + used) / 4;
+                _firstBlock = (used + 63) & ~(size_t)63;
+            }
+            // Shared nodes live in the table, so the root takes the arena
+            // from here.
+            auto doc = new Data(_arena);
+            doc->CopyContent(*d);
+            doc->_ownsArena = true;
+            doc->_borrowedArrays = (bool)_trees;
+            _arena = nullptr;
+            _scalar = nullptr;
+            return doc;
+        }
+
+        size_t MemoryUsed(void * d) override {
+            if (d) return DocumentBytes(d);
+            return _arena && !_borrowed ? _arena->Bytes() : 0;
+        }
+
+        // Bytes held by a document DocumentFinalize() returned.
+        static size_t DocumentBytes(void * _d) {
+            auto d = (Data *)_d;
+            return sizeof(Data) + (d->_ownsArena ? d->_arena->Bytes() : 0);
+        }
+
+        void * Free(void * _d) override {
+            // Nodes inside an arena are reclaimed with it; only document
+            // roots are released individually.
+            auto d = (Data *)_d;
+            if (d->_ownsArena) delete d;
+            return nullptr;
+        }
+
+        // Drops the nodes of a document left unfinished, once the parser
+        // has freed its values.
+        void Reset() {
+            if (!_borrowed) {
+                delete _arena;
+                _arena = nullptr;
+            }
+            _scalar = nullptr;
+            _depth = 0;
+        }
+    };
+
+    // Changes Data trees, writing only to nodes of one arena. A node from
+    // anywhere else (a shared subtree, another document) is copied into
+    // the arena, and the copy linked in its place, before it is changed.
+    // Hashes, key indices and list views cached by a changed node are
+    // dropped, so every node on the way down to a change has to be made
+    // writable, from the root. Nothing may read the nodes it changes
+    // meanwhile.
+    class TreeEditor {
+    private:
+        Arena * _arena;
+        // Table the keys of the arena's alists are interned in, if any.
+        KeyTable::State * _keys;
+
+        // Gives d arrays of its own, in the arena.
+        void OwnArrays(Data * d) {
+            if (d->_itemCount) {
+                auto items = (const IData **)_arena->Alloc(sizeof(const IData *) * d->_itemCount,
+                                                           alignof(const IData *));
+                memcpy(items, d->_items, sizeof(const IData *) * d->_itemCount);
+                d->_items = items;
+            }
+            d->_itemCap = d->_itemCount;
+            if (d->_kvCount) {
+                auto kvs = (DataKV *)_arena->Alloc(sizeof(DataKV) * d->_kvCount, alignof(DataKV));
+                memcpy(kvs, d->_kvs, sizeof(DataKV) * d->_kvCount);
+                d->_kvs = kvs;
+            }
+            d->_kvCap = d->_kvCount;
+            d->_borrowedArrays = false;
+        }
+
+        static Data * Mutable(const IData * d) {
+            return const_cast<Data *>(static_cast<const Data *>(d));
+        }
+
+    public:
+        explicit TreeEditor(Arena * arena)
+            : _arena(arena), _keys((KeyTable::State *)arena->Keys()) { }
+
+        Arena * GetArena() const { return _arena; }
+        static Arena * ArenaOf(const Data * d) { return d->_arena; }
+
+        // The alist d, which must be a Data node, if it may be changed;
+        // otherwise a copy of it that may.
+        Data * Writable(const IData * _d) {
+            auto d = Mutable(_d);
+            // Expands a lazy alist before its fields are used.
+            d->Size();
+            if (d->_arena != _arena) {
+                auto c = _arena->New<Data>(_arena, Data::T_ALIST);
+                c->CopyContent(*d);
+                OwnArrays(c);
+                d = c;
+            }
+            else if (d->_borrowedArrays) {
+                OwnArrays(d);
+            }
+            d->_hash.store(0, std::memory_order_relaxed);
+            d->_legacy.store(nullptr, std::memory_order_relaxed);
+            return d;
+        }
+
+        // Item i of the writable d, made writable in turn.
+        Data * WritableItem(Data * d, size_t i) {
+            auto c = Writable(d->_items[i]);
+            d->_items[i] = c;
+            return c;
+        }
+
+        // Value of pair i of the writable d, made writable in turn.
+        Data * WritableValue(Data * d, size_t i) {
+            auto c = Writable(d->_kvs[i].value);
+            d->_kvs[i].value = c;
+            return c;
+        }
+
+        // Scalar node with a copy of s.
+        Data * NewScalar(Data::Type type, const Slice & s) {
+            auto n = _arena->New<Data>(_arena, type);
+            if (!s.empty()) {
+                n->_str = _arena->CopyBytes(s.data(), s.size());
+                n->_strLen = n->_strCap = (uint32_t)s.size();
+            }
+            return n;
+        }
+
+        // Key text for k in the arena, or interned if the arena's keys are.
+        Slice NewKey(const Slice & k) {
+            if (_keys) return KeyTable::Intern(*_keys, k, HashBytes(k.data(), k.size()))->_text;
+            return Slice(_arena->CopyBytes(k.data(), k.size()), k.size());
+        }
+
+        // Copy of the tree v in the arena.
+        Data * Copy(const IData * v) {
+            struct Frame {
+                const IData *   src;
+                Data *          dst;
+                size_t          next;
+            };
+            std::vector<Frame> stack;
+
+            // The copy of v if it is a scalar; otherwise an alist with
+            // room for the children of v, whose frame is pushed.
+            auto node = [&](const IData * v) {
+                if (v == nullptr) return NewScalar(Data::T_UNKNOWN, Slice());
+                if (v->GetType() != Data::T_ALIST) return NewScalar(v->GetType(), v->GetSlice());
+                auto n = _arena->New<Data>(_arena, Data::T_ALIST);
+                n->_itemCap = (uint32_t)v->Size();
+                n->_kvCap = (uint32_t)v->KVSize();
+                if (n->_itemCap) {
+                    n->_items = (const IData **)_arena->Alloc(sizeof(const IData *) * n->_itemCap,
+                                                              alignof(const IData *));
+                }
+                if (n->_kvCap) {
+                    n->_kvs = (DataKV *)_arena->Alloc(sizeof(DataKV) * n->_kvCap, alignof(DataKV));
+                }
+                stack.push_back(Frame{v, n, 0});
+                return n;
+            };
+
+            auto root = node(v);
+            while (!stack.empty()) {
+                Frame & f = stack.back();
+                auto d = f.dst;
+                if (f.next == (size_t)d->_itemCap + d->_kvCap) {
+                    stack.pop_back();
+                    continue;
+                }
+                size_t i = f.next++;
+                if (i < d->_itemCap) {
+                    auto src = f.src->At(i);
+                    // May push a frame, so f is not used past this point.
+                    d->_items[d->_itemCount++] = node(src);
+                }
+                else {
+                    i -= d->_itemCap;
+                    d->_kvs[i].SetKey(NewKey(f.src->KeyAt(i)));
+                    auto src = f.src->ValueAt(i);
+                    d->_kvs[i].value = node(src);
+                    ++d->_kvCount;
+                }
+            }
+            return root;
+        }
+
+        // Index of the first pair of d with key k, or SIZE_MAX.
+        static size_t FindPair(const Data * d, const Slice & k) {
+            for (uint32_t i = 0; i < d->_kvCount; ++i) {
+                if (d->KeySlice(i) == k) return i;
+            }
+            return SIZE_MAX;
+        }
+
+        // The rest change the writable alist d.
+        void SetItem(Data * d, size_t i, const IData * v) {
+            d->_items[i] = v;
+        }
+
+        void InsertItem(Data * d, size_t i, const IData * v) {
+            d->_items = GrowArray(_arena, d->_items, d->_itemCount, d->_itemCap);
+            memmove(d->_items + i + 1, d->_items + i, sizeof(const IData *) * (d->_itemCount - i));
+            d->_items[i] = v;
+            ++d->_itemCount;
+        }
+
+        void RemoveItems(Data * d, size_t i, size_t n) {
+            memmove(d->_items + i, d->_items + i + n, sizeof(const IData *) * (d->_itemCount - i - n));
+            d->_itemCount -= (uint32_t)n;
+        }
+
+        void SetValue(Data * d, size_t i, const IData * v) {
+            d->_kvs[i].value = v;
+        }
+
+        void InsertPair(Data * d, size_t i, const Slice & key, const IData * v) {
+            d->_kvs = GrowArray(_arena, d->_kvs, d->_kvCount, d->_kvCap);
+            memmove(d->_kvs + i + 1, d->_kvs + i, sizeof(DataKV) * (d->_kvCount - i));
+            d->_kvs[i].SetKey(key);
+            d->_kvs[i].value = v;
+            ++d->_kvCount;
+            d->_index.store(nullptr, std::memory_order_relaxed);
+        }
+
+        void RemovePair(Data * d, size_t i) {
+            memmove(d->_kvs + i, d->_kvs + i + 1, sizeof(DataKV) * (d->_kvCount - i - 1));
+            --d->_kvCount;
+            d->_index.store(nullptr, std::memory_order_relaxed);
+        }
+
+        // A step of a path: an item index, or the key of the first pair
+        // with it.
+        struct Step {
+            bool    isKey;
+            size_t  index;
+            Slice   key;
+        };
+
+        enum Change { SET, INSERT, REMOVE };
+
+        // Carries out change at the end of path, n > 0 steps below the
+        // writable alist root. SET replaces the value reached with a copy
+        // of value. INSERT puts a copy in before the item index the path
+        // ends with, or as pair at (the last if SIZE_MAX) with the key it
+        // ends with. REMOVE takes out count items from the index, or the
+        // pair. With adopt, value is a node made in the arena for the
+        // change, as by NewScalar(), and goes in as it is. Throws
+        // std::out_of_range for a path the tree does not have.
+        void Apply(Data * root, const Step * path, size_t n, Change change,
+                   const IData * value, size_t at = SIZE_MAX, size_t count = 1,
+                   bool adopt = false) {
+            auto place = [&]() { return adopt ? value : Copy(value); };
+            if (root->GetType() != Data::T_ALIST) throw std::out_of_range("path through a scalar");
+            Data * d = root;
+            for (size_t s = 0; ; ++s) {
+                bool last = s + 1 == n;
+                size_t i = path[s].index;
+                if (path[s].isKey) {
+                    i = FindPair(d, path[s].key);
+                    if (i == SIZE_MAX && !(last && change == INSERT)) throw std::out_of_range("path key not found");
+                }
+                else if (i > d->_itemCount || (i == d->_itemCount && !(last && change == INSERT))) {
+                    throw std::out_of_range("path index past the end");
+                }
+
+                if (!last) {
+                    auto next = path[s].isKey ? d->_kvs[i].value : d->_items[i];
+                    if (next->GetType() != Data::T_ALIST) throw std::out_of_range("path through a scalar");
+                    d = path[s].isKey ? WritableValue(d, i) : WritableItem(d, i);
+                    continue;
+                }
+
+                if (change == SET) {
+                    if (path[s].isKey) SetValue(d, i, place());
+                    else SetItem(d, i, place());
+                }
+                else if (change == INSERT && path[s].isKey) {
+                    if (at == SIZE_MAX) at = d->_kvCount;
+                    if (at > d->_kvCount) throw std::out_of_range("pair position past the end");
+                    InsertPair(d, at, NewKey(path[s].key), place());
+                }
+                else if (change == INSERT) {
+                    InsertItem(d, i, place());
+                }
+                else if (path[s].isKey) {
+                    RemovePair(d, i);
+                }
+                else {
+                    if (count > d->_itemCount - i) throw std::out_of_range("removing past the end");
+                    RemoveItems(d, i, count);
+                }
+                return;
+            }
+        }
+
+        // Makes the writable d hold what v, a tree of the arena, does.
+        static void Assign(Data * d, const Data * v) {
+            d->CopyContent(*v);
+            d->_borrowedArrays = false;
+            d->_legacy.store(nullptr, std::memory_order_relaxed);
+            d->_index.store(nullptr, std::memory_order_relaxed);
+        }
+    };
+
+    // ApplyPatch() on the writable alist root of ed; done counts the
+    // operations carried out, also when one throws.
+    void ApplyPatch(TreeEditor & ed, Data * root, const IData * patch, size_t & done);
+}
+
+#endif
@@ -0,0 +1,447 @@
+#include "alist.hpp"
+#include "alist_data.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace alist;
+using namespace std;
+
+struct SliceHash {
+    size_t operator()(const Slice & s) const { return (size_t)HashBytes(s.data(), s.size()); }
+};
+
+static uint64_t HashOf(const IData * d) {
+    return d ? d->Hash() : 0;
+}
+
+// Indices into seq of a longest strictly increasing subsequence of it.
+static vector<size_t> LongestIncreasing(const vector<size_t> & seq) {
+    // tails[k]: index of the smallest last element of the increasing
+    // subsequences of length k + 1 found so far.
+    vector<size_t> tails;
+    vector<size_t> prev(seq.size(), SIZE_MAX);
+    for (size_t i = 0; i < seq.size(); ++i) {
+        auto at = partition_point(tails.begin(), tails.end(),
+                                  [&](size_t t) { return seq[t] < seq[i]; });
+        if (at != tails.begin()) prev[i] = *(at - 1);
+        if (at == tails.end()) tails.push_back(i);
+        else *at = i;
+    }
+
+    vector<size_t> r(tails.size());
+    size_t i = tails.empty() ? SIZE_MAX : tails.back();
+    for (size_t k = r.size(); k > 0; --k) {
+        r[k - 1] = i;
+        i = prev[i];
+    }
+    return r;
+}
+
+// Pairs (i, j), increasing in both, of items a[i] equal to b[j], as
+// patience diff finds them: the common prefix and suffix, then the
+// subtrees that occur once on each side and keep their order, then the
+// same again in each stretch between those.
+static vector<pair<size_t, size_t>> Align(const IData * a, const IData * b) {
+    size_t na = a->Size();
+    size_t nb = b->Size();
+    vector<uint64_t> ha(na), hb(nb);
+    for (size_t i = 0; i < na; ++i) ha[i] = HashOf(a->At(i));
+    for (size_t j = 0; j < nb; ++j) hb[j] = HashOf(b->At(j));
+    auto same = [&](size_t i, size_t j) {
+        return ha[i] == hb[j] && Equal(a->At(i), b->At(j));
+    };
+
+    struct Stretch {
+        size_t a0, a1, b0, b1;
+    };
+    // Times a hash occurs on each side of a stretch, and where it last
+    // did; open-addressed, a power of two in size, at most half full.
+    struct Count {
+        uint64_t hash;
+        size_t inA, inB, i, j;
+    };
+    vector<Count> counts;
+    vector<size_t> slotOf(nb);
+    vector<pair<size_t, size_t>> matches;
+    vector<Stretch> todo(1, Stretch{0, na, 0, nb});
+    while (!todo.empty()) {
+        auto s = todo.back();
+        todo.pop_back();
+        while (s.a0 < s.a1 && s.b0 < s.b1 && same(s.a0, s.b0)) {
+            matches.push_back(make_pair(s.a0++, s.b0++));
+        }
+        while (s.a0 < s.a1 && s.b0 < s.b1 && same(s.a1 - 1, s.b1 - 1)) {
+            matches.push_back(make_pair(--s.a1, --s.b1));
+        }
+        if (s.a0 == s.a1 || s.b0 == s.b1) continue;
+
+        size_t size = 16;
+        while (size < (s.a1 - s.a0) * 2) size *= 2;
+        size_t mask = size - 1;
+        counts.assign(size, Count{0, 0, 0, 0, 0});
+        // Slot of h, or the empty one where it would go.
+        auto slot = [&](uint64_t h) {
+            size_t p = h & mask;
+            while (counts[p].inA && counts[p].hash != h) p = (p + 1) & mask;
+            return p;
+        };
+        for (size_t i = s.a0; i < s.a1; ++i) {
+            auto & c = counts[slot(ha[i])];
+            c.hash = ha[i];
+            ++c.inA;
+            c.i = i;
+        }
+        for (size_t j = s.b0; j < s.b1; ++j) {
+            size_t p = slot(hb[j]);
+            slotOf[j] = p;
+            if (counts[p].inA == 0) continue;
+            ++counts[p].inB;
+            counts[p].j = j;
+        }
+        // Unique on both sides, in the order of b.
+        vector<pair<size_t, size_t>> unique;
+        for (size_t j = s.b0; j < s.b1; ++j) {
+            auto & c = counts[slotOf[j]];
+            if (c.inA != 1 || c.inB != 1) continue;
+            if (Equal(a->At(c.i), b->At(j))) unique.push_back(make_pair(c.i, j));
+        }
+        vector<size_t> order(unique.size());
+        for (size_t k = 0; k < unique.size(); ++k) order[k] = unique[k].first;
+        auto keep = LongestIncreasing(order);
+        if (keep.empty()) continue;
+
+        size_t a0 = s.a0, b0 = s.b0;
+        for (auto k : keep) {
+            auto m = unique[k];
+            todo.push_back(Stretch{a0, m.first, b0, m.second});
+            matches.push_back(m);
+            a0 = m.first + 1;
+            b0 = m.second + 1;
+        }
+        todo.push_back(Stretch{a0, s.a1, b0, s.b1});
+    }
+    sort(matches.begin(), matches.end());
+    return matches;
+}
+
+// Builds the patch document.
+class PatchWriter {
+private:
+    ParseOperator   _op;
+    void *          _ops;
+
+public:
+    // A step of a path, linked to the one before it.
+    struct Step {
+        size_t  prev;
+        bool    isKey;
+        size_t  index;
+        Slice   key;
+    };
+    static constexpr size_t ROOT = SIZE_MAX;
+    vector<Step> steps;
+
+    // Anything left unfinished goes with the operator's arena.
+    PatchWriter() : _ops(_op.AListNew()) { }
+
+    size_t IndexStep(size_t prev, size_t i) {
+        steps.push_back(Step{prev, false, i, Slice()});
+        return steps.size() - 1;
+    }
+
+    size_t KeyStep(size_t prev, const Slice & k) {
+        steps.push_back(Step{prev, true, 0, k});
+        return steps.size() - 1;
+    }
+
+    void * Literal(const string & s) {
+        return _op.LiteralNew(s.data(), (int)s.size());
+    }
+
+    void * String(const Slice & s) {
+        auto d = _op.StringNew();
+        _op.StringAppendByteArray(d, (const unsigned char *)s.data(), (int)s.size());
+        return _op.StringFinalize(d);
+    }
+
+    void * Path(size_t step) {
+        vector<size_t> chain;
+        for (; step != ROOT; step = steps[step].prev) chain.push_back(step);
+        auto path = _op.AListNew();
+        for (size_t k = chain.size(); k > 0; --k) {
+            auto & s = steps[chain[k - 1]];
+            _op.AListAppendItem(path, s.isKey ? String(s.key) : Literal(to_string(s.index)));
+        }
+        return _op.AListFinalize(path);
+    }
+
+    // Copy of the tree v.
+    void * Value(const IData * v) {
+        struct Frame {
+            const IData *   src;
+            void *          dst;
+            size_t          next;
+            size_t          items;
+            size_t          size;
+            // Key the alist goes under in its parent, if it is a value.
+            void *          key;
+        };
+        vector<Frame> stack;
+        void * result = nullptr;
+
+        // Adds n, complete, to the alist being copied, or makes it the result.
+        auto attach = [&](void * n, void * key) {
+            if (stack.empty()) result = n;
+            else if (key) _op.AListAppendKV(stack.back().dst, key, true, n);
+            else _op.AListAppendItem(stack.back().dst, n);
+        };
+
+        auto visit = [&](const IData * v, void * key) {
+            if (v == nullptr) {
+                attach(Literal(string()), key);
+                return;
+            }
+            switch (v->GetType()) {
+            case IData::T_STRING:
+                attach(String(v->GetSlice()), key);
+                break;
+            case IData::T_ALIST: {
+                size_t items = v->Size();
+                stack.push_back(Frame{v, _op.AListNew(), 0, items, items + v->KVSize(), key});
+                break;
+            }
+            default: {
+                Slice s = v->GetSlice();
+                attach(_op.LiteralNew(s.data(), (int)s.size()), key);
+                break;
+            }
+            }
+        };
+
+        visit(v, nullptr);
+        while (!stack.empty()) {
+            Frame & f = stack.back();
+            if (f.next == f.size) {
+                auto n = _op.AListFinalize(f.dst);
+                auto key = f.key;
+                stack.pop_back();
+                attach(n, key);
+                continue;
+            }
+            size_t i = f.next++;
+            if (i < f.items) {
+                auto child = f.src->At(i);
+                // May push a frame, so f is not used past this point.
+                visit(child, nullptr);
+            }
+            else {
+                Slice k = f.src->KeyAt(i - f.items);
+                auto key = _op.AListKey(f.dst, _op.LiteralNew(k.data(), (int)k.size()), true);
+                auto child = f.src->ValueAt(i - f.items);
+                visit(child, key);
+            }
+        }
+        return result;
+    }
+
+    // Appends the operation [name path args...], with the pair at=N if
+    // at is set.
+    void Op(const char * name, size_t step, void * arg = nullptr, const size_t * at = nullptr,
+            const size_t * count = nullptr) {
+        auto op = _op.AListNew();
+        _op.AListAppendItem(op, Literal(name));
+        _op.AListAppendItem(op, Path(step));
+        if (arg) _op.AListAppendItem(op, arg);
+        if (count) _op.AListAppendItem(op, Literal(to_string(*count)));
+        if (at) _op.AListAppendKV(op, _op.AListKey(op, Literal("at"), true), true, Literal(to_string(*at)));
+        _op.AListAppendItem(_ops, _op.AListFinalize(op));
+    }
+
+    unique_ptr<const IData> Finish() {
+        auto doc = _op.DocumentFinalize(_op.AListFinalize(_ops));
+        return unique_ptr<const IData>((const IData *)doc);
+    }
+};
+
+// Whether some key occurs twice among the pairs of d, whose keys are put
+// in first with their indices.
+static bool DuplicateKeys(const IData * d, unordered_map<Slice, size_t, SliceHash> & first) {
+    first.clear();
+    for (size_t i = 0; i < d->KVSize(); ++i) {
+        if (!first.emplace(d->KeyAt(i), i).second) return true;
+    }
+    return false;
+}
+
+unique_ptr<const IData> alist::Diff(const IData * a, const IData * b) {
+    PatchWriter w;
+    if (Equal(a, b)) return w.Finish();
+    if (a == nullptr || b == nullptr ||
+        a->GetType() != IData::T_ALIST || b->GetType() != IData::T_ALIST) {
+        w.Op("set", PatchWriter::ROOT, w.Value(b));
+        return w.Finish();
+    }
+
+    // Alists that differ, with the path to them. Paths use the positions
+    // of b, which every alist on the way has once its own operations are
+    // carried out, and those come before any below them.
+    struct Task {
+        const IData *   a;
+        const IData *   b;
+        size_t          step;
+    };
+    vector<Task> todo(1, Task{a, b, PatchWriter::ROOT});
+    unordered_map<Slice, size_t, SliceHash> keysA, keysB;
+
+    // Carries on into x and y if both are alists, or replaces x with y.
+    auto change = [&](const IData * x, const IData * y, size_t step) {
+        if (x && y && x->GetType() == IData::T_ALIST && y->GetType() == IData::T_ALIST) {
+            todo.push_back(Task{x, y, step});
+        }
+        else {
+            w.Op("set", step, w.Value(y));
+        }
+    };
+
+    while (!todo.empty()) {
+        auto t = todo.back();
+        todo.pop_back();
+
+        if (DuplicateKeys(t.a, keysA) || DuplicateKeys(t.b, keysB)) {
+            w.Op("set", t.step, w.Value(t.b));
+            continue;
+        }
+
+        // Items: those left over between the aligned ones are changed in
+        // place as far as they line up; the rest are removed, from the
+        // last, then inserted, from the first.
+        size_t na = t.a->Size();
+        size_t nb = t.b->Size();
+        auto matches = Align(t.a, t.b);
+        matches.push_back(make_pair(na, nb));
+        vector<pair<size_t, size_t>> removed;
+        vector<size_t> inserted;
+        vector<pair<size_t, size_t>> changed;
+        size_t i = 0, j = 0;
+        for (auto m : matches) {
+            size_t n = min(m.first - i, m.second - j);
+            for (size_t k = 0; k < n; ++k) changed.push_back(make_pair(i + k, j + k));
+            if (i + n < m.first) removed.push_back(make_pair(i + n, m.first - i - n));
+            for (size_t k = j + n; k < m.second; ++k) inserted.push_back(k);
+            i = m.first + 1;
+            j = m.second + 1;
+        }
+        for (size_t k = removed.size(); k > 0; --k) {
+            auto r = removed[k - 1];
+            w.Op("del", w.IndexStep(t.step, r.first), nullptr, nullptr, r.second > 1 ? &r.second : nullptr);
+        }
+        for (auto k : inserted) w.Op("ins", w.IndexStep(t.step, k), w.Value(t.b->At(k)));
+        for (auto c : changed) {
+            change(t.a->At(c.first), t.b->At(c.second), w.IndexStep(t.step, c.second));
+        }
+
+        // Pairs: matched by key, those whose keys are out of order are
+        // moved by removing and inserting them.
+        vector<pair<size_t, size_t>> common;
+        for (size_t k = 0; k < t.b->KVSize(); ++k) {
+            auto it = keysA.find(t.b->KeyAt(k));
+            if (it != keysA.end()) common.push_back(make_pair(it->second, k));
+        }
+        vector<size_t> order(common.size());
+        for (size_t k = 0; k < common.size(); ++k) order[k] = common[k].first;
+        auto keep = LongestIncreasing(order);
+
+        vector<bool> keptA(t.a->KVSize()), keptB(t.b->KVSize());
+        for (auto k : keep) {
+            keptA[common[k].first] = true;
+            keptB[common[k].second] = true;
+        }
+        for (size_t k = 0; k < keptA.size(); ++k) {
+            if (!keptA[k]) w.Op("del", w.KeyStep(t.step, t.a->KeyAt(k)));
+        }
+        for (size_t k = 0; k < keptB.size(); ++k) {
+            if (!keptB[k]) w.Op("ins", w.KeyStep(t.step, t.b->KeyAt(k)), w.Value(t.b->ValueAt(k)), &k);
+        }
+        for (auto k : keep) {
+            auto x = t.a->ValueAt(common[k].first);
+            auto y = t.b->ValueAt(common[k].second);
+            if (!Equal(x, y)) change(x, y, w.KeyStep(t.step, t.b->KeyAt(common[k].second)));
+        }
+    }
+    return w.Finish();
+}
+
+static invalid_argument BadOperation(const char * what) {
+    return invalid_argument(string("patch operation ") + what);
+}
+
+// The number n is made of, if it is a literal number.
+static bool Number(const IData * n, size_t & v) {
+    if (n == nullptr || n->GetType() != IData::T_LITERAL) return false;
+    Slice s = n->GetSlice();
+    auto r = from_chars(s.begin(), s.end(), v);
+    return !s.empty() && r.ec == errc() && r.ptr == s.end();
+}
+
+void alist::ApplyPatch(IData * doc, const IData * patch) {
+    auto root = (Data *)doc;
+    TreeEditor ed(TreeEditor::ArenaOf(root));
+    size_t done = 0;
+    // The root is in its own arena, so it stays where it is.
+    ApplyPatch(ed, ed.Writable(root), patch, done);
+}
+
+void alist::ApplyPatch(TreeEditor & ed, Data * root, const IData * patch, size_t & done) {
+    vector<TreeEditor::Step> steps;
+
+    for (size_t o = 0; o < patch->Size(); ++o) {
+        auto op = patch->At(o);
+        if (op == nullptr || op->GetType() != IData::T_ALIST || op->Size() < 2) {
+            throw BadOperation("is not [name path ...]");
+        }
+        Slice name = op->At(0)->GetSlice();
+        auto path = op->At(1);
+        if (path->GetType() != IData::T_ALIST || path->KVSize() != 0) {
+            throw BadOperation("path is not a list of steps");
+        }
+        auto arg = op->At(2);
+        TreeEditor::Change change;
+        if (name == Slice("set")) change = TreeEditor::SET;
+        else if (name == Slice("ins")) change = TreeEditor::INSERT;
+        else if (name == Slice("del")) change = TreeEditor::REMOVE;
+        else throw BadOperation("is not set, ins or del");
+        if (change != TreeEditor::REMOVE && arg == nullptr) throw BadOperation("has no value");
+
+        if (path->Size() == 0) {
+            if (change != TreeEditor::SET) throw BadOperation("on the root is not set");
+            TreeEditor::Assign(root, ed.Copy(arg));
+            ++done;
+            continue;
+        }
+
+        steps.clear();
+        for (size_t s = 0; s < path->Size(); ++s) {
+            auto step = path->At(s);
+            TreeEditor::Step st{false, 0, Slice()};
+            if (!Number(step, st.index)) {
+                st.isKey = true;
+                st.key = step->GetSlice();
+            }
+            steps.push_back(st);
+        }
+
+        size_t at = SIZE_MAX;
+        size_t count = 1;
+        auto a = op->Find(Slice("at"));
+        if (change == TreeEditor::INSERT && a && !Number(a, at)) throw BadOperation("position is not a number");
+        if (change == TreeEditor::REMOVE && arg && !Number(arg, count)) throw BadOperation("count is not a number");
+        ed.Apply(root, steps.data(), steps.size(), change, arg, at, count);
+        ++done;
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef __ALIST_EVENT__
+#define __ALIST_EVENT__
+
+#include "alist.hpp"
+#include <string>
+
+namespace alist {
+
+    // Builder that turns the parser callbacks into IHandler events. No
+    // values are built: alists are reported as they open and close, and
+    // the one scalar whose role is not yet known (an item or a key) is
+    // kept in _pending until the parser settles it.
+    class EventOperator final : public IOperator {
+    private:
+        IHandler *      _handler;
+        std::string     _pending;
+        bool            _pendingLiteral;
+        // Distinct tokens standing in for values on the parser stacks.
+        char            _list;
+        char            _scalar;
+
+        void * List() { return &_list; }
+        void * Scalar() { return &_scalar; }
+
+        void Emit() {
+            if (_pendingLiteral) {
+                _handler->OnLiteral(Slice(_pending));
+            }
+            else {
+                if (!_pending.empty()) _handler->OnStringChunk(Slice(_pending));
+                _handler->OnStringEnd();
+            }
+            _pending.clear();
+        }
+
+    public:
+        explicit EventOperator(IHandler * handler)
+            : _handler(handler)
+            , _pendingLiteral(false)
+            , _list(0)
+            , _scalar(0)
+            { }
+
+        void * AListNew() override {
+            _handler->OnListBegin();
+            return List();
+        }
+
+        void * AListAppendItem(void * d, void * i) override {
+            if (i == Scalar()) Emit();
+            return d;
+        }
+
+        void * AListKey(void * /*d*/, void * key, bool isLiteral) override {
+            _handler->OnKey(Slice(_pending), isLiteral);
+            _pending.clear();
+            return key;
+        }
+
+        void * AListAppendKV(void * d, void * /*key*/, bool /*isLiteral*/, void * value) override {
+            if (value == Scalar()) Emit();
+            return d;
+        }
+
+        void * AListFinalize(void * d) override {
+            _handler->OnListEnd();
+            return d;
+        }
+
+        void * StringNew() override {
+            _pending.clear();
+            _pendingLiteral = false;
+            return Scalar();
+        }
+
+        void * StringAppendByte(void * d, unsigned char b) override {
+            _pending.push_back(b);
+            return d;
+        }
+
+        void * StringAppendByteArray(void * d, const unsigned char * b, int l) override {
+            _pending.append((const char *)b, l);
+            return d;
+        }
+
+        void * StringFinalize(void * d) override {
+            return d;
+        }
+
+        void * LiteralNew(const char * str, int len) override {
+            _pending.assign(str, len);
+            _pendingLiteral = true;
+            return Scalar();
+        }
+
+        void * Free(void * d) override {
+            if (d == Scalar()) _pending.clear();
+            return nullptr;
+        }
+
+        void Reset() {
+            _pending.clear();
+        }
+
+        void * DocumentFinalize(void * d) override {
+            if (d == Scalar()) Emit();
+            _handler->OnDocumentEnd();
+            return nullptr;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,201 @@
+#include "alist.hpp"
+#include "alist_data.hpp"
+#include <mutex>
+#include <utility>
+#include <vector>
+
+using namespace alist;
+using namespace std;
+
+uint64_t IData::Hash() const {
+    uint64_t h;
+    if (CachedHash(h)) return h;
+
+    // One frame per alist walked into: the next of its items, followed by
+    // its pairs, to fold into its hash.
+    struct Frame {
+        const IData *   d;
+        size_t          next;
+        size_t          items;
+        size_t          size;
+        uint64_t        h;
+    };
+    vector<Frame> stack;
+
+    // Sets h to the hash of v if it is known or v is a scalar, or pushes
+    // the frame of v and returns false.
+    auto visit = [&](const IData * v) {
+        if (v == nullptr) {
+            h = 0;
+            return true;
+        }
+        if (v->CachedHash(h)) return true;
+        if (v->GetType() != T_ALIST) {
+            h = HashFinish(HashScalar(v->GetType(), v->GetSlice()));
+            v->CacheHash(h);
+            return true;
+        }
+        size_t items = v->Size();
+        size_t kvs = v->KVSize();
+        stack.push_back(Frame{v, 0, items, items + kvs, HashAList(items, kvs)});
+        return false;
+    };
+
+    if (visit(this)) return h;
+    while (true) {
+        Frame & f = stack.back();
+        if (f.next == f.size) {
+            h = HashFinish(f.h);
+            f.d->CacheHash(h);
+            stack.pop_back();
+            if (stack.empty()) return h;
+            stack.back().h = HashCombine(stack.back().h, h);
+            continue;
+        }
+
+        size_t i = f.next++;
+        const IData * child;
+        if (i < f.items) {
+            child = f.d->At(i);
+        }
+        else {
+            Slice k = f.d->KeyAt(i - f.items);
+            f.h = HashCombine(f.h, HashBytes(k.data(), k.size()));
+            child = f.d->ValueAt(i - f.items);
+        }
+        // May push a frame, so f is stale past this point.
+        if (visit(child)) stack.back().h = HashCombine(stack.back().h, h);
+    }
+}
+
+bool alist::Equal(const IData * a, const IData * b) {
+    if (a == b) return true;
+    if (a == nullptr || b == nullptr) return false;
+    // Leaves the hash of every node below in the nodes that keep one.
+    if (a->Hash() != b->Hash()) return false;
+
+    vector<pair<const IData *, const IData *>> stack(1, make_pair(a, b));
+    while (!stack.empty()) {
+        auto x = stack.back().first;
+        auto y = stack.back().second;
+        stack.pop_back();
+        if (x == y) continue;
+        if (x == nullptr || y == nullptr || x->GetType() != y->GetType()) return false;
+
+        uint64_t hx, hy;
+        if (x->CachedHash(hx) && y->CachedHash(hy) && hx != hy) return false;
+        if (x->GetType() != IData::T_ALIST) {
+            if (x->GetSlice() != y->GetSlice()) return false;
+            continue;
+        }
+
+        size_t items = x->Size();
+        size_t kvs = x->KVSize();
+        if (items != y->Size() || kvs != y->KVSize()) return false;
+        for (size_t i = 0; i < items; ++i) {
+            stack.push_back(make_pair(x->At(i), y->At(i)));
+        }
+        for (size_t i = 0; i < kvs; ++i) {
+            if (x->KeyAt(i) != y->KeyAt(i)) return false;
+            stack.push_back(make_pair(x->ValueAt(i), y->ValueAt(i)));
+        }
+    }
+    return true;
+}
+
+struct SubtreeTable::State {
+    // Holds the shared nodes; its lock, which their readers take too,
+    // guards the table.
+    Arena           arena;
+    // Open-addressed by hash; a power of two in size, at most half full.
+    vector<const Data *> slots;
+    size_t          count;
+
+    State() : count(0) { }
+};
+
+SubtreeTable::SubtreeTable()
+    : _state(make_shared<State>()) {
+}
+
+SubtreeTable::~SubtreeTable() {
+}
+
+// Whether d has the content of n. The children of both are table nodes,
+// so equal subtrees are the same node; keys are compared by text, as
+// Equal() does.
+static bool SameContent(const Data * d, const Data * n) {
+    if (d->GetType() != n->GetType() || d->GetSlice() != n->GetSlice() ||
+        d->Size() != n->Size() || d->KVSize() != n->KVSize()) {
+        return false;
+    }
+    for (size_t i = 0; i < d->Size(); ++i) {
+        if (d->At(i) != n->At(i)) return false;
+    }
+    for (size_t i = 0; i < d->KVSize(); ++i) {
+        if (d->KeyAt(i) != n->KeyAt(i) || d->ValueAt(i) != n->ValueAt(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const Data * SubtreeTable::Intern(State & st, const Data * d) {
+    uint64_t hash = d->_hash.load(memory_order_relaxed);
+    lock_guard<mutex> g(st.arena.Lock());
+    if (st.slots.empty()) st.slots.resize(64);
+
+    size_t mask = st.slots.size() - 1;
+    size_t p = hash & mask;
+    while (st.slots[p]) {
+        auto n = st.slots[p];
+        if (n->_hash.load(memory_order_relaxed) == hash && SameContent(d, n)) return n;
+        p = (p + 1) & mask;
+    }
+
+    auto & a = st.arena;
+    auto n = a.New<Data>(&a, d->_type);
+    if (d->_str) {
+        n->_str = a.CopyBytes(d->_str, d->_strLen);
+        n->_strLen = d->_strLen;
+        n->_strCap = d->_strLen;
+    }
+    if (d->_itemCount) {
+        auto items = (const IData **)a.Alloc(sizeof(const IData *) * d->_itemCount, alignof(const IData *));
+        memcpy(items, d->_items, sizeof(const IData *) * d->_itemCount);
+        n->_items = items;
+        n->_itemCount = n->_itemCap = d->_itemCount;
+    }
+    if (d->_kvCount) {
+        // The keys are the text of shared scalars, already in the table.
+        auto kvs = (DataKV *)a.Alloc(sizeof(DataKV) * d->_kvCount, alignof(DataKV));
+        memcpy(kvs, d->_kvs, sizeof(DataKV) * d->_kvCount);
+        n->_kvs = kvs;
+        n->_kvCount = n->_kvCap = d->_kvCount;
+    }
+    n->_hash.store(hash, memory_order_relaxed);
+    st.slots[p] = n;
+
+    if (++st.count * 2 > st.slots.size()) {
+        vector<const Data *> slots(st.slots.size() * 2);
+        mask = slots.size() - 1;
+        for (auto s : st.slots) {
+            if (s == nullptr) continue;
+            p = s->_hash.load(memory_order_relaxed) & mask;
+            while (slots[p]) p = (p + 1) & mask;
+            slots[p] = s;
+        }
+        st.slots.swap(slots);
+    }
+    return n;
+}
+
+size_t SubtreeTable::Size() const {
+    lock_guard<mutex> g(_state->arena.Lock());
+    return _state->count;
+}
+
+size_t SubtreeTable::Bytes() const {
+    lock_guard<mutex> g(_state->arena.Lock());
+    return _state->arena.Bytes();
+}
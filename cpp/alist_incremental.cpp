@@ -0,0 +1,336 @@
+#include "alist.hpp"
+#include "alist_data.hpp"
+#include "alist_parser.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace alist;
+using namespace std;
+
+// A top-level value and where it lies in the text.
+struct Doc {
+    Data *  root;
+    size_t  begin;
+    size_t  end;
+    // Bytes of it re-parsed in place so far; the nodes they replaced are
+    // still held by its arena.
+    size_t  replaced;
+};
+
+// Values parsed from one range of the text.
+struct Range {
+    vector<Doc>         docs;
+    vector<NodeSpan>    nodes;
+    size_t              end;
+    size_t              unfinished;
+
+    void Free() {
+        for (auto && d : docs) delete d.root;
+        docs.clear();
+    }
+};
+
+// The text, its values and where they lie.
+struct Tree {
+    // The syntax points into these copies of the caller's character sets.
+    string              chars[7];
+    RuntimeSyntax       syntax;
+    string              text;
+    // Complete top-level values and the nested alists inside them, both
+    // ordered by begin. Spans of nested alists nest properly.
+    vector<Doc>         docs;
+    vector<NodeSpan>    nodes;
+    // Start of an unfinished value at the end of the text, or SIZE_MAX.
+    size_t              tail;
+    size_t              errorLine;
+
+    Tree(const char * const c[7], const string & t)
+        : chars{ c[0], c[1], c[2], c[3], c[4], c[5], c[6] }
+        , syntax(chars[0].c_str(), chars[1].c_str(), chars[2].c_str(), chars[3].c_str(),
+                 chars[4].c_str(), chars[5].c_str(), chars[6].c_str())
+        , text(t), tail(SIZE_MAX), errorLine(0) { }
+
+    ~Tree() {
+        for (auto && d : docs) delete d.root;
+    }
+};
+
+struct IncrementalDocument::State : Tree {
+    using Tree::Tree;
+};
+
+static size_t LineStart(const string & text, size_t p) {
+    auto nl = (const char *)memrchr(text.data(), '\n', p);
+    return nl ? nl - text.data() + 1 : 0;
+}
+
+// Start of the line after the one holding p.
+static size_t LineEnd(const string & text, size_t p) {
+    if (p >= text.size()) return text.size();
+    auto nl = (const char *)memchr(text.data() + p, '\n', text.size() - p);
+    return nl ? nl - text.data() + 1 : text.size();
+}
+
+// Replaces the entries of v beginning in [from, to) with repl and moves
+// the ones after them by delta.
+template<class T>
+static void ReplaceEntries(vector<T> & v, size_t from, size_t to, vector<T> & repl, ptrdiff_t delta) {
+    auto first = partition_point(v.begin(), v.end(), [&](const T & e) { return e.begin < from; });
+    auto last = partition_point(first, v.end(), [&](const T & e) { return e.begin < to; });
+    for (auto i = last; i != v.end(); ++i) {
+        i->begin += delta;
+        i->end += delta;
+    }
+    size_t at = first - v.begin();
+    v.erase(first, last);
+    v.insert(v.begin() + at, repl.begin(), repl.end());
+}
+
+// Parses the text in [from, to). With extend, a value left unfinished at
+// to is followed to the end of the text. On a ParseException, line is
+// set to the line it was thrown on.
+static Range Parse(const Tree & st, size_t from, size_t to, bool extend, size_t & line) {
+    ParseOperator op;
+    BasicParser<RuntimeSyntax, ParseOperator> parser(st.syntax, &op, true);
+    vector<NodeSpan> spans;
+    Range r;
+
+    try {
+        parser.RecordSpans(&spans, from);
+        parser.ParseBuffer(st.text.data() + from, to - from);
+        if (extend && to < st.text.size() && parser.Unfinished() != SIZE_MAX) {
+            parser.RecordSpans(&spans, to);
+            parser.ParseBuffer(st.text.data() + to, st.text.size() - to);
+            to = st.text.size();
+        }
+    }
+    catch (const ParseException &) {
+        line = count(st.text.data(), st.text.data() + from, '\n') + parser.GetLineNumber();
+        throw;
+    }
+
+    r.end = to;
+    r.unfinished = parser.Unfinished();
+    // Alists inside the unfinished value go with it.
+    parser.Seal();
+    while (parser.Extract()) { }
+
+    for (auto && s : spans) {
+        if (s.top) r.docs.push_back(Doc{(Data *)s.node, s.begin, s.end, 0});
+        else if (s.begin < r.unfinished) r.nodes.push_back(s);
+    }
+    // Nested alists are recorded as they close, innermost first.
+    sort(r.nodes.begin(), r.nodes.end(),
+         [](const NodeSpan & x, const NodeSpan & y) { return x.begin < y.begin; });
+    return r;
+}
+
+// Parses [from, to) as exactly one alist; false if it is not one.
+static bool ParseAList(const Tree & st, size_t from, size_t to, Range & r) {
+    size_t line;
+    try {
+        r = Parse(st, from, to, false, line);
+    }
+    catch (const ParseException &) {
+        return false;
+    }
+    if (r.unfinished == SIZE_MAX && r.docs.size() == 1 &&
+        r.docs[0].begin == from && r.docs[0].end == to &&
+        r.docs[0].root->GetType() == IData::T_ALIST) {
+        return true;
+    }
+    r.Free();
+    return false;
+}
+
+static void ParseAll(Tree & st) {
+    Range r;
+    try {
+        r = Parse(st, 0, st.text.size(), false, st.errorLine);
+    }
+    catch (const ParseException &) {
+        if (st.errorLine == 0) st.errorLine = 1;
+        throw;
+    }
+    for (auto && d : st.docs) delete d.root;
+    st.docs.swap(r.docs);
+    st.nodes.swap(r.nodes);
+    st.tail = r.unfinished;
+    st.errorLine = 0;
+}
+
+// Re-parses the smallest alist holding the edit of [a, b), which is now
+// n bytes, inside its brackets. False if there is none or no alist
+// around the edit parses to the same extent.
+static bool ParseEnclosing(Tree & st, size_t a, size_t b, size_t n) {
+    ptrdiff_t delta = (ptrdiff_t)n - (ptrdiff_t)(b - a);
+
+    auto di = partition_point(st.docs.begin(), st.docs.end(),
+                              [&](const Doc & d) { return d.begin < a; }) - st.docs.begin();
+    if (di == 0) return false;
+    Doc & doc = st.docs[--di];
+    if (b >= doc.end || doc.root->GetType() != IData::T_ALIST) return false;
+
+    auto nodeAfter = [&](size_t p) {
+        return partition_point(st.nodes.begin(), st.nodes.end(),
+                               [&](const NodeSpan & s) { return s.begin < p; }) - st.nodes.begin();
+    };
+    size_t first = nodeAfter(doc.begin + 1);
+    Range r;
+
+    // Nested alists around the edit, innermost first. Once the nodes
+    // given up exceed the size of the document, it is re-parsed whole
+    // instead so that they are released.
+    for (size_t k = nodeAfter(a); k-- > first; ) {
+        NodeSpan x = st.nodes[k];
+        if (x.end <= b) continue;
+        if (doc.replaced + (x.end - x.begin) > doc.end - doc.begin) break;
+        if (!ParseAList(st, x.begin, x.end + delta, r)) continue;
+
+        // Hashes cached by the alists around it no longer hold.
+        Data * parent = doc.root;
+        doc.root->CacheHash(0);
+        for (size_t j = k; j-- > first; ) {
+            if (st.nodes[j].end >= x.end) {
+                if (parent == doc.root) parent = (Data *)st.nodes[j].node;
+                st.nodes[j].end += delta;
+                ((Data *)st.nodes[j].node)->CacheHash(0);
+            }
+        }
+        Data * now = r.docs[0].root;
+        if (!parent->ReplaceChild((const IData *)x.node, now)) {
+            delete now;
+            throw logic_error("incremental document out of step with its tree");
+        }
+
+        r.nodes.insert(r.nodes.begin(), NodeSpan{now, x.begin, x.end + delta, false});
+        ReplaceEntries(st.nodes, x.begin, x.end, r.nodes, delta);
+        vector<Doc> none;
+        ReplaceEntries(st.docs, doc.end, doc.end, none, delta);
+        doc.end += delta;
+        doc.replaced += x.end - x.begin;
+        if (st.tail != SIZE_MAX) st.tail += delta;
+        return true;
+    }
+
+    if (!ParseAList(st, doc.begin, doc.end + delta, r)) return false;
+    size_t begin = doc.begin, end = doc.end;
+    delete doc.root;
+    ReplaceEntries(st.nodes, begin, end, r.nodes, delta);
+    ReplaceEntries(st.docs, begin, end, r.docs, delta);
+    if (st.tail != SIZE_MAX) st.tail += delta;
+    return true;
+}
+
+// Re-parses the whole lines around the edit of [a, b), which is now n
+// bytes, widened until no top-level value crosses their ends.
+static void ParseLines(Tree & st, size_t a, size_t b, size_t n) {
+    ptrdiff_t delta = (ptrdiff_t)n - (ptrdiff_t)(b - a);
+    // Where an offset before the edit is now.
+    auto shift = [&](size_t p) { return p >= b ? p + delta : p <= a ? p : a + n; };
+    auto endingAfter = [&](size_t p) {
+        return partition_point(st.docs.begin(), st.docs.end(),
+                               [&](const Doc & d) { return d.end <= p; }) - st.docs.begin();
+    };
+
+    size_t from = LineStart(st.text, st.tail <= a ? st.tail : a);
+    size_t i0 = endingAfter(from);
+    while (i0 < st.docs.size() && st.docs[i0].begin < from) {
+        from = LineStart(st.text, st.docs[i0].begin);
+        i0 = endingAfter(from);
+    }
+
+    size_t to = LineEnd(st.text, a + n);
+    size_t i1 = i0;
+    for (; i1 < st.docs.size(); ++i1) {
+        auto && d = st.docs[i1];
+        if (d.begin >= b && shift(d.begin) >= to) break;
+        to = max(to, LineEnd(st.text, shift(d.end) - 1));
+    }
+    if (st.tail != SIZE_MAX && shift(st.tail) < to) to = st.text.size();
+
+    Range r;
+    try {
+        r = Parse(st, from, to, true, st.errorLine);
+    }
+    catch (const ParseException &) {
+        if (st.errorLine == 0) st.errorLine = 1;
+        throw;
+    }
+
+    if (r.end == st.text.size()) {
+        i1 = st.docs.size();
+        st.tail = r.unfinished;
+    }
+    else if (st.tail != SIZE_MAX) {
+        st.tail += delta;
+    }
+
+    size_t oldEnd = i1 < st.docs.size() ? st.docs[i1].begin : SIZE_MAX;
+    for (size_t i = i0; i < i1; ++i) delete st.docs[i].root;
+    ReplaceEntries(st.nodes, from, oldEnd, r.nodes, delta);
+    ReplaceEntries(st.docs, from, oldEnd, r.docs, delta);
+}
+
+IncrementalDocument::IncrementalDocument(const string & text,
+                                         const char * c_whitespace,
+                                         const char * c_line_comment,
+                                         const char * c_item_sep,
+                                         const char * c_kv_sep,
+                                         const char * c_quote,
+                                         const char * c_open,
+                                         const char * c_close)
+    : _state(nullptr) {
+    const char * chars[] = { c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                             c_quote, c_open, c_close };
+    _state = new State(chars, text);
+    // A failed parse leaves the document empty with ErrorLine() set.
+    try {
+        ParseAll(*_state);
+    }
+    catch (const ParseException &) { }
+    catch (...) {
+        delete _state;
+        throw;
+    }
+}
+
+IncrementalDocument::~IncrementalDocument() {
+    delete _state;
+}
+
+void IncrementalDocument::Edit(size_t offset, size_t len, const Slice & text) {
+    State & st = *_state;
+    if (offset > st.text.size() || len > st.text.size() - offset) {
+        throw out_of_range("edit outside the document");
+    }
+    st.text.replace(offset, len, text.data(), text.size());
+
+    // Spans no longer match the text once it failed to parse.
+    if (st.errorLine) {
+        ParseAll(st);
+        return;
+    }
+    if (ParseEnclosing(st, offset, offset + len, text.size())) return;
+    ParseLines(st, offset, offset + len, text.size());
+}
+
+const string & IncrementalDocument::Text() const {
+    return _state->text;
+}
+
+size_t IncrementalDocument::ErrorLine() const {
+    return _state->errorLine;
+}
+
+size_t IncrementalDocument::Size() const {
+    return _state->docs.size();
+}
+
+const IData * IncrementalDocument::At(size_t i) const {
+    return i < _state->docs.size() ? _state->docs[i].root : nullptr;
+}
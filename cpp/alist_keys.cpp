@@ -0,0 +1,65 @@
+#include "alist.hpp"
+#include "alist_data.hpp"
+#include <mutex>
+#include <vector>
+
+using namespace alist;
+using namespace std;
+
+struct KeyTable::State {
+    // Holds the keys and their text.
+    Arena           arena;
+    mutex           lock;
+    // Open-addressed by hash; a power of two in size, at most half full.
+    vector<Key *>   slots;
+    size_t          count;
+
+    State() : count(0) { }
+};
+
+KeyTable::KeyTable()
+    : _state(make_shared<State>()) {
+}
+
+KeyTable::~KeyTable() {
+}
+
+const Key * KeyTable::Intern(State & st, const Slice & s, uint64_t hash) {
+    lock_guard<mutex> g(st.lock);
+    if (st.slots.empty()) st.slots.resize(64);
+
+    size_t mask = st.slots.size() - 1;
+    size_t p = hash & mask;
+    while (st.slots[p]) {
+        if (st.slots[p]->_hash == hash && st.slots[p]->_text == s) return st.slots[p];
+        p = (p + 1) & mask;
+    }
+
+    auto key = st.arena.New<Key>();
+    key->_text = Slice(st.arena.CopyBytes(s.data(), s.size()), s.size());
+    key->_hash = hash;
+    key->_table = &st;
+    st.slots[p] = key;
+
+    if (++st.count * 2 > st.slots.size()) {
+        vector<Key *> slots(st.slots.size() * 2);
+        mask = slots.size() - 1;
+        for (auto k : st.slots) {
+            if (k == nullptr) continue;
+            p = k->_hash & mask;
+            while (slots[p]) p = (p + 1) & mask;
+            slots[p] = k;
+        }
+        st.slots.swap(slots);
+    }
+    return key;
+}
+
+const Key * KeyTable::Intern(const Slice & s) {
+    return Intern(*_state, s, HashBytes(s.data(), s.size()));
+}
+
+size_t KeyTable::Size() const {
+    lock_guard<mutex> g(_state->lock);
+    return _state->count;
+}
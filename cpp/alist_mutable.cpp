@@ -0,0 +1,232 @@
+#include "alist.hpp"
+#include "alist_data.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+using namespace alist;
+using namespace std;
+
+// Edits between compactions take at least this much before one is made.
+static const size_t MIN_COMPACT_BYTES = 64 * 1024;
+
+// Nodes of the snapshots made since a compaction. Each commit allocates
+// into an arena of its own, which nothing writes to once it is published,
+// so readers that cache hashes, indices or list views of its nodes (or
+// expand lazy alists) only ever share an arena's lock with each other.
+struct Generation {
+    // Document the first generation starts from; later ones start from a
+    // compacted copy, in the first of the arenas.
+    unique_ptr<const IData> doc;
+    vector<unique_ptr<Arena>> arenas;
+    // Bytes the tree took when the generation started, and bytes the
+    // commits have taken since.
+    size_t baseBytes;
+    size_t addedBytes;
+
+    Generation() : baseBytes(0), addedBytes(0) { }
+};
+
+// What a snapshot holds on to.
+struct Pinned {
+    shared_ptr<const Generation> gen;
+    const Data * root;
+};
+
+struct MutableDocument::State {
+    // Held by the edit in progress.
+    mutex writer;
+    Snapshot current;
+    atomic<uint64_t> version;
+    // Generation and root of current; only writers use them.
+    shared_ptr<Generation> gen;
+    const Data * root;
+
+    State() : version(0), root(nullptr) { }
+};
+
+struct MutableDocument::Edit::State {
+    MutableDocument::State * doc;
+    unique_lock<mutex> lock;
+    unique_ptr<Arena> arena;
+    TreeEditor ed;
+    // The root once it has been made writable; until then the edit has
+    // changed nothing.
+    Data * root;
+    vector<TreeEditor::Step> steps;
+
+    explicit State(MutableDocument::State * d)
+        : doc(d), lock(d->writer), arena(new Arena()), ed(arena.get()), root(nullptr) { }
+
+    // Calls change with the root, made writable again (reading the tree
+    // since may have cached its hash), and keeps it unless change throws
+    // before it has done anything, as counted by done if given. If the
+    // edit had changed nothing before, what change allocated is then
+    // given back: nothing else refers to it.
+    template<class F>
+    void Change(F change, const size_t * done = nullptr) {
+        auto mark = arena->GetMark();
+        Data * r = ed.Writable(root ? root : doc->root);
+        try {
+            change(r);
+        }
+        catch (...) {
+            if (done && *done) root = r;
+            else if (root == nullptr) arena->Rewind(mark);
+            throw;
+        }
+        root = r;
+    }
+
+    const TreeEditor::Step * Steps(const Path & path) {
+        steps.clear();
+        for (auto && s : path) steps.push_back(TreeEditor::Step{s.IsKey(), s.Index(), s.Key()});
+        return steps.data();
+    }
+};
+
+MutableDocument::MutableDocument(unique_ptr<const IData> doc)
+    : _state(new State()) {
+    auto gen = make_shared<Generation>();
+    auto root = (const Data *)doc.get();
+    gen->baseBytes = ParseOperator::DocumentBytes((void *)root);
+    gen->doc = std::move(doc);
+    _state->current = Snapshot(make_shared<Pinned>(Pinned{gen, root}), root);
+    _state->gen = gen;
+    _state->root = root;
+}
+
+MutableDocument::~MutableDocument() {
+    delete _state;
+}
+
+MutableDocument::Snapshot MutableDocument::Get() const {
+    return atomic_load(&_state->current);
+}
+
+uint64_t MutableDocument::Version() const {
+    return _state->version.load(memory_order_acquire);
+}
+
+MutableDocument::Edit MutableDocument::Begin() {
+    return Edit(_state);
+}
+
+MutableDocument::Edit::Edit(MutableDocument::State * doc)
+    : _state(new State(doc)) {
+}
+
+MutableDocument::Edit::Edit(Edit && o) = default;
+MutableDocument::Edit & MutableDocument::Edit::operator=(Edit && o) = default;
+MutableDocument::Edit::~Edit() = default;
+
+MutableDocument::Edit & MutableDocument::Edit::Set(const Path & path, const IData * value) {
+    auto & st = *_state;
+    if (path.empty()) {
+        st.root = st.ed.Copy(value);
+        return *this;
+    }
+    st.Change([&](Data * root) {
+        st.ed.Apply(root, st.Steps(path), path.size(), TreeEditor::SET, value);
+    });
+    return *this;
+}
+
+MutableDocument::Edit & MutableDocument::Edit::Set(const Path & path, const Slice & literal) {
+    auto & st = *_state;
+    if (path.empty()) {
+        st.root = st.ed.NewScalar(IData::T_LITERAL, literal);
+        return *this;
+    }
+    st.Change([&](Data * root) {
+        st.ed.Apply(root, st.Steps(path), path.size(), TreeEditor::SET,
+                    st.ed.NewScalar(IData::T_LITERAL, literal), SIZE_MAX, 1, true);
+    });
+    return *this;
+}
+
+MutableDocument::Edit & MutableDocument::Edit::Insert(const Path & path, const IData * value, size_t at) {
+    auto & st = *_state;
+    if (path.empty()) throw out_of_range("insert at the root");
+    st.Change([&](Data * root) {
+        st.ed.Apply(root, st.Steps(path), path.size(), TreeEditor::INSERT, value, at);
+    });
+    return *this;
+}
+
+MutableDocument::Edit & MutableDocument::Edit::Insert(const Path & path, const Slice & literal, size_t at) {
+    auto & st = *_state;
+    if (path.empty()) throw out_of_range("insert at the root");
+    st.Change([&](Data * root) {
+        st.ed.Apply(root, st.Steps(path), path.size(), TreeEditor::INSERT,
+                    st.ed.NewScalar(IData::T_LITERAL, literal), at, 1, true);
+    });
+    return *this;
+}
+
+MutableDocument::Edit & MutableDocument::Edit::Remove(const Path & path, size_t count) {
+    auto & st = *_state;
+    if (path.empty()) throw out_of_range("remove the root");
+    st.Change([&](Data * root) {
+        st.ed.Apply(root, st.Steps(path), path.size(), TreeEditor::REMOVE, nullptr, SIZE_MAX, count);
+    });
+    return *this;
+}
+
+MutableDocument::Edit & MutableDocument::Edit::Apply(const IData * patch) {
+    auto & st = *_state;
+    size_t done = 0;
+    // The operations before one that throws stay.
+    st.Change([&](Data * root) { ApplyPatch(st.ed, root, patch, done); }, &done);
+    return *this;
+}
+
+const IData * MutableDocument::Edit::Get() const {
+    return _state->root ? _state->root : _state->doc->root;
+}
+
+MutableDocument::Snapshot MutableDocument::Edit::Commit() {
+    auto & st = *_state;
+    auto doc = st.doc;
+    if (st.root == nullptr) {
+        st.lock.unlock();
+        return atomic_load(&doc->current);
+    }
+
+    auto gen = doc->gen;
+    const Data * root = st.root;
+    gen->addedBytes += st.arena->Bytes();
+    gen->arenas.push_back(std::move(st.arena));
+    if (gen->addedBytes > max(gen->baseBytes, MIN_COMPACT_BYTES)) {
+        gen = make_shared<Generation>();
+        unique_ptr<Arena> arena(new Arena());
+        root = TreeEditor(arena.get()).Copy(root);
+        gen->baseBytes = arena->Bytes();
+        gen->arenas.push_back(std::move(arena));
+    }
+
+    Snapshot snapshot(make_shared<Pinned>(Pinned{gen, root}), root);
+    atomic_store(&doc->current, snapshot);
+    doc->gen = gen;
+    doc->root = root;
+    doc->version.fetch_add(1, memory_order_release);
+    st.lock.unlock();
+    return snapshot;
+}
+
+MutableDocument::Reader::Reader(const MutableDocument & doc)
+    : _doc(&doc), _version(doc.Version()), _snapshot(doc.Get()) {
+}
+
+const IData * MutableDocument::Reader::Get() {
+    uint64_t v = _doc->Version();
+    if (v != _version) {
+        // Published before the version moved on, so at least as new.
+        _snapshot = _doc->Get();
+        _version = v;
+    }
+    return _snapshot.get();
+}
@@ -0,0 +1,379 @@
+#include "alist.hpp"
+#include "alist_data.hpp"
+#include "alist_parser.hpp"
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace alist;
+using namespace std;
+
+// Pieces smaller than this are not worth a task of their own.
+static const size_t MIN_CHUNK = 1 << 20;
+
+// Runs task(0) .. task(n - 1) on up to threads threads, the caller being
+// one of them. Each thread starts on an equal contiguous share of the
+// tasks, taking them from the front; once its share is exhausted it
+// steals from the back of the other shares.
+static void RunTasks(size_t n, unsigned threads, const function<void(size_t)> & task) {
+    struct Share {
+        mutex   m;
+        size_t  lo;
+        size_t  hi;
+    };
+
+    threads = (unsigned)min<size_t>(threads, n);
+    if (threads <= 1) {
+        for (size_t i = 0; i < n; ++i) task(i);
+        return;
+    }
+
+    unique_ptr<Share[]> shares(new Share[threads]);
+    for (unsigned t = 0; t < threads; ++t) {
+        shares[t].lo = n * t / threads;
+        shares[t].hi = n * (t + 1) / threads;
+    }
+
+    auto worker = [&](unsigned self) {
+        while (true) {
+            size_t i = n;
+            {
+                lock_guard<mutex> g(shares[self].m);
+                if (shares[self].lo < shares[self].hi) i = shares[self].lo++;
+            }
+            for (unsigned k = 1; i == n && k < threads; ++k) {
+                auto && victim = shares[(self + k) % threads];
+                lock_guard<mutex> g(victim.m);
+                if (victim.lo < victim.hi) i = --victim.hi;
+            }
+            if (i == n) return;
+            task(i);
+        }
+    };
+
+    vector<thread> pool;
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker, t);
+    worker(0);
+    for (auto && th : pool) th.join();
+}
+
+class ParallelParser : public IParser {
+private:
+    // A piece of the input and what parsing it produced.
+    struct Chunk {
+        size_t              begin;
+        size_t              end;
+        IParser *           parser;
+        size_t              lineBase;
+        vector<void *>      results;
+        exception_ptr       error;
+    };
+
+    unsigned                _threads;
+    vector<string>          _chars;
+    BoundaryScanner         _scan;
+    BoundaryScanner::State  _state;
+    // Parses the input that continues a document left open by the
+    // previous call, and the last piece, which may leave one open.
+    IParser *               _seq;
+    deque<void *>           _results;
+    // Bytes held by _results, and what Feed() may hold.
+    size_t                  _queuedBytes;
+    ParseLimits             _limits;
+    IResultHandler *        _handler;
+    // Input given to Feed() but not parsed yet, the first _whole bytes
+    // of it being whole lines.
+    string                  _feed;
+    size_t                  _whole;
+    size_t                  _lineNum;
+    bool                    _sealed;
+    // Counts of the parsers already deleted.
+    ParseStats              _stats;
+
+    IParser * NewParser() const {
+        return CreateParser(nullptr, true, _chars[0].c_str(), _chars[1].c_str(),
+                            _chars[2].c_str(), _chars[3].c_str(), _chars[4].c_str(),
+                            _chars[5].c_str(), _chars[6].c_str());
+    }
+
+    static size_t CountLines(const char * p, size_t n) {
+        return count(p, p + n, '\n');
+    }
+
+    void Deliver(void * v) {
+        if (_handler) {
+            _handler->OnResult(v);
+        }
+        else {
+            _results.push_back(v);
+            _queuedBytes += ParseOperator::DocumentBytes(v);
+        }
+    }
+
+    bool Full() const {
+        return !_handler &&
+            ((_limits.maxResults && _results.size() >= _limits.maxResults) ||
+             (_limits.maxResultBytes && _queuedBytes >= _limits.maxResultBytes));
+    }
+
+    // Parses the lines collected by Feed(), and the unfinished one too if
+    // all is set.
+    void Flush(bool all) {
+        size_t n = all ? _feed.size() : _whole;
+        if (n == 0) return;
+        _whole = 0;
+        try {
+            Parse(_feed.data(), n, false);
+        }
+        catch (...) {
+            _feed.clear();
+            throw;
+        }
+        _feed.erase(0, n);
+#ifdef ALIST_STATS
+        if (!_feed.empty()) {
+            ++_stats.compactions;
+            _stats.bytesMoved += _feed.size();
+        }
+#endif
+    }
+
+    void ParseChunk(const char * data, Chunk & c, bool stable) {
+        try {
+            if (stable) c.parser->ParseStable(data + c.begin, c.end - c.begin);
+            else c.parser->ParseBuffer(data + c.begin, c.end - c.begin);
+            if (c.parser != _seq) c.parser->Seal();
+        }
+        catch (...) {
+            c.error = current_exception();
+        }
+        while (auto v = c.parser->Extract()) c.results.push_back(v);
+    }
+
+    void Parse(const char * data, size_t size, bool stable) {
+        if (_sealed || size == 0) return;
+
+        // Lines before the first clean line start finish the document the
+        // previous call left open.
+        size_t start = _state.Clean() ? 0 : _scan.Scan(data, 0, size, 0, _state);
+
+        size_t target = max(MIN_CHUNK, size / (_threads * 8));
+        vector<Chunk> chunks;
+        if (start > 0) {
+            chunks.push_back(Chunk{0, start, _seq, _seq->GetLineNumber(), {}, nullptr});
+        }
+        for (size_t b = start; b < size; ) {
+            size_t e = _scan.Scan(data, b, size, b + target, _state);
+            chunks.push_back(Chunk{b, e, nullptr, 0, {}, nullptr});
+            b = e;
+        }
+
+        // The head runs first since _seq also takes the last piece; every
+        // other piece starts at the top level and gets a parser of its own.
+        size_t first = start > 0 ? 1 : 0;
+        if (first) ParseChunk(data, chunks[0], stable);
+        if (!chunks[0].error && chunks.size() > first) {
+            chunks.back().parser = _seq;
+            chunks.back().lineBase = _seq->GetLineNumber();
+            for (size_t i = first; i + 1 < chunks.size(); ++i) {
+                chunks[i].parser = NewParser();
+            }
+            RunTasks(chunks.size() - first, _threads, [&](size_t i) {
+                ParseChunk(data, chunks[first + i], stable);
+            });
+        }
+
+        exception_ptr error;
+        size_t errorLine = 0;
+        for (auto && c : chunks) {
+            if (error) {
+                for (auto v : c.results) delete (IData *)v;
+            }
+            else {
+                for (auto v : c.results) Deliver(v);
+                if (c.error) {
+                    error = c.error;
+                    errorLine = _lineNum + CountLines(data, c.begin) +
+                        c.parser->GetLineNumber() - c.lineBase;
+                }
+            }
+            if (c.parser != nullptr && c.parser != _seq) {
+                _stats.Merge(c.parser->GetStats());
+                delete c.parser;
+            }
+        }
+
+        if (error) {
+            _lineNum = errorLine;
+            DropOpen();
+            rethrow_exception(error);
+        }
+        _lineNum += CountLines(data, size) + (data[size - 1] != '\n' ? 1 : 0);
+    }
+
+    // Drops whatever document was left open and starts over at the top
+    // level.
+    void DropOpen() {
+        _stats.Merge(_seq->GetStats());
+        delete _seq;
+        _seq = NewParser();
+        _state = BoundaryScanner::State();
+    }
+
+public:
+    ParallelParser(unsigned threads, const char * c_whitespace, const char * c_line_comment,
+                   const char * c_item_sep, const char * c_kv_sep,
+                   const char * c_quote, const char * c_open, const char * c_close)
+        : _threads(threads ? threads : max(1u, thread::hardware_concurrency()))
+        , _chars{c_whitespace, c_line_comment, c_item_sep, c_kv_sep, c_quote, c_open, c_close}
+        , _scan(c_whitespace, c_line_comment, c_item_sep, c_kv_sep, c_quote, c_open, c_close)
+        , _seq(nullptr)
+        , _queuedBytes(0)
+        , _handler(nullptr)
+        , _whole(0)
+        , _lineNum(0)
+        , _sealed(false) {
+        _seq = NewParser();
+    }
+
+    ~ParallelParser() {
+        delete _seq;
+        for (auto v : _results) delete (IData *)v;
+    }
+
+    void ParseLine(const string & line) override {
+        if (_sealed) return;
+        Flush(true);
+        string l = line + '\n';
+        _scan.Scan(l.data(), 0, l.size(), l.size(), _state);
+        ++_lineNum;
+        try {
+            _seq->ParseLine(line);
+        }
+        catch (...) {
+            while (auto v = _seq->Extract()) Deliver(v);
+            DropOpen();
+            throw;
+        }
+        while (auto v = _seq->Extract()) Deliver(v);
+    }
+
+    void ParseBuffer(const char * data, size_t size) override {
+        Flush(true);
+        Parse(data, size, false);
+    }
+
+    void ParseStable(const char * data, size_t size) override {
+        Flush(true);
+        Parse(data, size, true);
+    }
+
+    void ParseFile(const char * path) override {
+        Flush(true);
+        MappedFile f(path);
+        Parse(f.Data(), f.Size(), false);
+    }
+
+    FeedStatus Feed(const char * data, size_t size) override {
+        if (_sealed) return FEED_OK;
+        if (Full()) return FEED_WOULD_BLOCK;
+        const char * end = data + size;
+        for (auto p = data; (p = (const char *)memchr(p, '\n', end - p)); ++p) {
+            _whole = _feed.size() + (p + 1 - data);
+        }
+        _feed.append(data, size);
+
+        // Under an input limit, lines are parsed before they would take
+        // the collected input past it, however few there are.
+        size_t max = _limits.maxBuffered;
+        if (_whole >= MIN_CHUNK || (max && _feed.size() > max)) Flush(false);
+        if (max && _feed.size() > max) {
+            _feed.clear();
+            throw ParseException("line longer than the input limit");
+        }
+        return FEED_OK;
+    }
+
+    void SetResultHandler(IResultHandler * handler) override {
+        _handler = handler;
+    }
+
+    void SetLimits(const ParseLimits & limits) override {
+        _limits = limits;
+    }
+
+    MemoryUsage GetMemoryUsage() const override {
+        MemoryUsage u = _seq->GetMemoryUsage();
+        u.buffered += _feed.capacity();
+        u.stacks += _results.size() * sizeof(void *);
+        u.queued += _queuedBytes;
+        u.results += _results.size();
+        return u;
+    }
+
+    size_t GetLineNumber() const override {
+        return _lineNum;
+    }
+
+    ParseStats GetStats() const override {
+        ParseStats stats = _stats;
+        stats.Merge(_seq->GetStats());
+        return stats;
+    }
+
+    void Seal() override {
+        if (_sealed) return;
+        try {
+            Flush(true);
+        }
+        catch (...) {
+            Seal();
+            throw;
+        }
+        _sealed = true;
+        _seq->Seal();
+        while (auto v = _seq->Extract()) Deliver(v);
+    }
+
+    void * Extract() override {
+        if (_results.empty()) return nullptr;
+        auto v = _results.front();
+        _results.pop_front();
+        _queuedBytes -= min(_queuedBytes, ParseOperator::DocumentBytes(v));
+        return v;
+    }
+
+    void Reset() override {
+        _seq->Reset();
+        _state = BoundaryScanner::State();
+        for (auto v : _results) delete (IData *)v;
+        _results.clear();
+        _queuedBytes = 0;
+        _limits = ParseLimits();
+        _handler = nullptr;
+        _feed.clear();
+        _whole = 0;
+        _lineNum = 0;
+        _sealed = false;
+        _stats = ParseStats();
+    }
+};
+
+IParser * alist::CreateParallelParser(unsigned threads,
+                                      const char * c_whitespace,
+                                      const char * c_line_comment,
+                                      const char * c_item_sep,
+                                      const char * c_kv_sep,
+                                      const char * c_quote,
+                                      const char * c_open,
+                                      const char * c_close) {
+    return new ParallelParser(threads, c_whitespace, c_line_comment, c_item_sep,
+                              c_kv_sep, c_quote, c_open, c_close);
+}
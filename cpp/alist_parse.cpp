@@ -1,6 +1,8 @@
 #include "alist.hpp"
 #include <string>
 #include <iostream>
+#include <fstream>
+#include <memory>
 #include <utility>
 #include <stdexcept>
 #include <iomanip>
@@ -8,39 +10,115 @@
 using namespace alist;
 using namespace std;
 
-int main() {
-    IParser * parser = CreateParser();
+static void PrintStats(const ParseStats & s) {
+    static const char * states[] = {
+        "element start", "element end", "alist", "alist with key",
+        "quoted string", "multi-line string"
+    };
+    static const char * callbacks[] = {
+        "AListNew", "AListAppendItem", "AListKey", "AListAppendKV", "AListFinalize",
+        "AListLazy", "StringNew", "StringAppend", "StringReserve", "StringFinalize",
+        "LiteralNew", "Free", "DocumentFinalize"
+    };
 
-    string line;
-    int line_num = 1;
-    bool succ;
-    while (true) {
-        succ = !!getline(cin, line);
-        try {
-            if (succ) {
-                parser->ParseLine(line);
-            }
-            else {
-                parser->Seal();
-            }
+    cerr << "bytes " << s.bytes << ", lines " << s.lines
+         << ", max depth " << s.maxDepth
+         << ", compactions " << s.compactions << " (" << s.bytesMoved << " bytes)"
+         << ", parse time " << s.parseNanos / 1e6 << " ms" << endl;
+    for (int i = 0; i < ParseStats::STATE_COUNT; ++i) {
+        cerr << "  state " << states[i] << ": " << s.steps[i] << endl;
+    }
+    for (int i = 0; i < ParseStats::CALLBACK_COUNT; ++i) {
+        cerr << "  " << callbacks[i] << ": " << s.callbacks[i] << endl;
+    }
+}
+
+static int Usage() {
+    cerr << "usage: alist_parse [-p] [-s] [-b FILE] [FILE]" << endl;
+    return 2;
+}
+
+int main(int argc, char ** argv) {
+    unique_ptr<IParser> parser(CreateParser());
+
+    // -p pretty-prints each result instead of writing it on one line;
+    // -b FILE writes them all to FILE in the binary format instead;
+    // -s prints the parser counters to stderr.
+    bool pretty = false;
+    bool stats = false;
+    const char * binary = nullptr;
+    while (argc > 1) {
+        if (string(argv[1]) == "-p") {
+            pretty = true;
+        }
+        else if (string(argv[1]) == "-s") {
+            stats = true;
+        }
+        else if (string(argv[1]) == "-b" && argc > 2) {
+            binary = argv[2];
+            --argc;
+            ++argv;
+        }
+        else if (argv[1][0] == '-' && argv[1][1] != '\0') {
+            return Usage();
         }
-        catch (const ParseException & e) {
-            if (succ) {
-                cerr << "Parsing error at line " << line_num << ": " << e.what() << endl;
-            }
-            else {
-                cerr << "Parsing error when sealing: " << e.what() << endl;
-            }
+        else {
+            break;
         }
+        --argc;
+        ++argv;
+    }
+    if (argc > 2) return Usage();
 
-        if (!succ) break;
-        ++line_num;
+    // Parse the file named on the command line (or stdin) as a whole
+    // buffer instead of feeding it line by line.
+    const char * path = argc > 1 ? argv[1] : "/dev/stdin";
+    try {
+        parser->ParseFile(path);
+        parser->Seal();
+    }
+    catch (const ParseException & e) {
+        cerr << "Parsing error at line " << parser->GetLineNumber() << ": " << e.what() << endl;
+        parser->Seal();
+    }
+    catch (const runtime_error & e) {
+        cerr << e.what() << endl;
+        return 1;
     }
 
+    if (stats) PrintStats(parser->GetStats());
+
+    Serializer serializer(pretty);
+    BinaryEncoder encoder;
+    string out;
     while (true) {
         auto v = parser->Extract();
         if (v == nullptr) break;
-        Dump(cout, (IData *)v); cout << endl;
+        if (binary) {
+            encoder.Add((IData *)v);
+        }
+        else {
+            serializer.Write(out, (IData *)v);
+            out.push_back('\n');
+        }
+        delete (IData *)v;
+        if (!binary && out.size() >= 64 * 1024) {
+            cout.write(out.data(), out.size());
+            out.clear();
+        }
+    }
+
+    if (binary) {
+        encoder.Finish(out);
+        ofstream f(binary, ios::binary);
+        f.write(out.data(), out.size());
+        if (!f) {
+            cerr << "cannot write " << binary << endl;
+            return 1;
+        }
+    }
+    else {
+        cout.write(out.data(), out.size());
     }
 
     return 0;
@@ -0,0 +1,1298 @@
+#ifndef __ALIST_PARSER__
+#define __ALIST_PARSER__
+
+#include "alist.hpp"
+#include "alist_scan.hpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstring>
+#ifdef ALIST_STATS
+#include <chrono>
+#endif
+
+namespace alist {
+
+    namespace detail {
+        template<size_t... I> struct IndexList { };
+        template<size_t N, size_t... I>
+        struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...> { };
+        template<size_t... I>
+        struct MakeIndexList<0, I...> { typedef IndexList<I...> Type; };
+
+        constexpr bool Contains(const char * s, char c) {
+            return *s == 0 ? false : (*s == c ? true : Contains(s + 1, c));
+        }
+
+        constexpr unsigned char IndexOf(const char * s, char c, unsigned char i = 0) {
+            return *s == c ? i : IndexOf(s + 1, c, i + 1);
+        }
+
+        struct ClassTable {
+            CharClass m[256];
+        };
+
+        // Same classification RuntimeSyntax builds, evaluated at compile time.
+        template<class Chars>
+        constexpr CharClass ClassOf(char c) {
+            return CharClass(
+                (Contains(Chars::Whitespace(), c) ? C_WHITESPACE : 0) |
+                (Contains(Chars::LineComment(), c) ? C_COMMENT : 0) |
+                (Contains(Chars::ItemSep(), c) ? C_ITEM_SEP : 0) |
+                (Contains(Chars::KVSep(), c) ? C_KV_SEP : 0) |
+                (Contains(Chars::Quote(), c) ? C_QUOTE : 0) |
+                (Contains(Chars::Open(), c) ? C_OPEN : 0) |
+                (Contains(Chars::Close(), c) ? C_CLOSE : 0),
+                Contains(Chars::Open(), c) ? IndexOf(Chars::Open(), c) :
+                Contains(Chars::Quote(), c) ? IndexOf(Chars::Quote(), c) : 0);
+        }
+
+        template<class Chars, size_t... I>
+        constexpr ClassTable BuildClassTable(IndexList<I...>) {
+            return ClassTable{{ ClassOf<Chars>((char)I)... }};
+        }
+
+        inline int HexDigit(unsigned char c) {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        }
+    }
+
+    // Vector scanners for the runs the state machine skips over.
+    struct SyntaxScanners {
+        ByteScanner whitespace;
+        ByteScanner special;
+        ByteScanner structure;
+        ByteScanner close;
+        std::vector<ByteScanner> quoteEnd;
+
+        SyntaxScanners(const char * c_whitespace, const char * c_line_comment,
+                       const char * c_item_sep, const char * c_kv_sep,
+                       const char * c_quote, const char * c_open, const char * c_close) {
+            // strchr() used to match the terminating NUL, so NUL bytes have
+            // always been skipped as whitespace.
+            whitespace.Add(c_whitespace);
+            whitespace.Add('\0');
+            special.Add(c_whitespace);
+            special.Add(c_line_comment);
+            special.Add(c_item_sep);
+            special.Add(c_kv_sep);
+            special.Add(c_quote);
+            special.Add(c_open);
+            special.Add(c_close);
+            // What opens or closes a value that can hold any byte.
+            structure.Add(c_line_comment);
+            structure.Add(c_quote);
+            structure.Add(c_open);
+            structure.Add(c_close);
+            close.Add(c_close);
+            // A quoted string runs until its delimiter or an escape.
+            for (const char * q = c_quote; *q; ++q) {
+                quoteEnd.push_back(ByteScanner());
+                quoteEnd.back().Add(*q);
+                quoteEnd.back().Add('\\');
+            }
+        }
+    };
+
+    // Syntax given by the character sets passed to CreateParser().
+    class RuntimeSyntax {
+    private:
+        const char *        _quote;
+        const char *        _close;
+        CharMap<CharClass>  _class;
+        SyntaxScanners      _scan;
+
+        // Marks the bytes of v with flag. The index of a byte is its first
+        // position in the set; an opening bracket's index wins over a quote's.
+        void SetClass(const char * v, unsigned char flag) {
+            for (int i = 0; v[i]; ++i) {
+                auto && c = _class.m[(unsigned char)v[i]];
+                if (c.flags & flag) continue;
+                if ((flag == C_OPEN || flag == C_QUOTE) && !(c.flags & C_OPEN)) {
+                    c.index = i;
+                }
+                c.flags |= flag;
+            }
+        }
+
+    public:
+        RuntimeSyntax(const char * c_whitespace, const char * c_line_comment,
+                      const char * c_item_sep, const char * c_kv_sep,
+                      const char * c_quote, const char * c_open, const char * c_close)
+            : _quote(c_quote)
+            , _close(c_close)
+            , _class(CharClass())
+            , _scan(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                    c_quote, c_open, c_close) {
+            SetClass(c_whitespace, C_WHITESPACE);
+            SetClass(c_line_comment, C_COMMENT);
+            SetClass(c_item_sep, C_ITEM_SEP);
+            SetClass(c_kv_sep, C_KV_SEP);
+            SetClass(c_quote, C_QUOTE);
+            SetClass(c_open, C_OPEN);
+            SetClass(c_close, C_CLOSE);
+        }
+
+        CharClass Class(char c) const { return _class[c]; }
+        char Quote(int i) const { return _quote[i]; }
+        char Close(int i) const { return _close[i]; }
+
+        size_t SkipWhitespace(const char * p, size_t n) const {
+            return _scan.whitespace.FindNot(p, n);
+        }
+        size_t FindSpecial(const char * p, size_t n) const {
+            return _scan.special.Find(p, n);
+        }
+        size_t FindStructure(const char * p, size_t n) const {
+            return _scan.structure.Find(p, n);
+        }
+        size_t FindClose(const char * p, size_t n) const {
+            return _scan.close.Find(p, n);
+        }
+        size_t FindQuoteEnd(int i, const char * p, size_t n) const {
+            return _scan.quoteEnd[i].Find(p, n);
+        }
+    };
+
+    // Syntax fixed at compile time. Chars provides constexpr functions
+    // Whitespace(), LineComment(), ItemSep(), KVSep(), Quote(), Open()
+    // and Close() returning the same sets CreateParser() takes.
+    template<class Chars>
+    class StaticSyntax {
+    public:
+        static constexpr detail::ClassTable TABLE =
+            detail::BuildClassTable<Chars>(typename detail::MakeIndexList<256>::Type());
+
+    private:
+        static const SyntaxScanners & Scanners() {
+            static const SyntaxScanners s(
+                Chars::Whitespace(), Chars::LineComment(), Chars::ItemSep(),
+                Chars::KVSep(), Chars::Quote(), Chars::Open(), Chars::Close());
+            return s;
+        }
+
+    public:
+        CharClass Class(char c) const { return TABLE.m[(unsigned char)c]; }
+        char Quote(int i) const { return Chars::Quote()[i]; }
+        char Close(int i) const { return Chars::Close()[i]; }
+
+        size_t SkipWhitespace(const char * p, size_t n) const {
+            return Scanners().whitespace.FindNot(p, n);
+        }
+        size_t FindSpecial(const char * p, size_t n) const {
+            return Scanners().special.Find(p, n);
+        }
+        size_t FindStructure(const char * p, size_t n) const {
+            return Scanners().structure.Find(p, n);
+        }
+        size_t FindClose(const char * p, size_t n) const {
+            return Scanners().close.Find(p, n);
+        }
+        size_t FindQuoteEnd(int i, const char * p, size_t n) const {
+            return Scanners().quoteEnd[i].Find(p, n);
+        }
+    };
+
+    template<class Chars>
+    constexpr detail::ClassTable StaticSyntax<Chars>::TABLE;
+
+    struct DefaultChars {
+        static constexpr const char * Whitespace() { return " \t"; }
+        static constexpr const char * LineComment() { return "#"; }
+        static constexpr const char * ItemSep() { return ","; }
+        static constexpr const char * KVSep() { return ":="; }
+        static constexpr const char * Quote() { return "'\""; }
+        static constexpr const char * Open() { return "[{"; }
+        static constexpr const char * Close() { return "]}"; }
+    };
+
+    typedef StaticSyntax<DefaultChars> DefaultSyntax;
+
+    // Follows just enough of the syntax to find where values end without
+    // parsing them: brackets, quoted and multi-line strings with their
+    // escapes, and comments. Used to split input at line starts where the
+    // parser is back at the top level, and to skip over nested alists.
+    class BoundaryScanner {
+    public:
+        struct State {
+            int     depth;
+            int     quote;
+            bool    multiline;
+            // Nothing but the opening quote or escapes since the string
+            // opened or its last escape, in which case the parser carries
+            // a one-line string over to the next line instead of ending it.
+            bool    pending;
+
+            State() : depth(0), quote(-1), multiline(false), pending(false) { }
+
+            bool Clean() const { return depth == 0 && quote < 0; }
+        };
+
+    private:
+        RuntimeSyntax       _syntax;
+        ByteScanner         _outside;
+        std::vector<ByteScanner> _inside;
+
+        // Scans p[from..n) onwards from st. Stops at the first clean line
+        // start at or after minEnd or, given the closing brackets expected
+        // (innermost last), just past the one that brings the depth to 0;
+        // a different closing bracket stops the scan at n. Line breaks
+        // passed are added to lines.
+        size_t Walk(const char * p, size_t from, size_t n, size_t minEnd, std::string * toClose,
+                    State & st, size_t & lines) const {
+            size_t i = from;
+            while (i < n) {
+                if (st.quote < 0) {
+                    i += _outside.Find(p + i, n - i);
+                    if (i >= n) break;
+
+                    char c = p[i];
+                    CharClass cls = _syntax.Class(c);
+                    if (c == '\n') {
+                        ++i;
+                        ++lines;
+                        if (st.depth == 0 && i >= minEnd) return i;
+                    }
+                    else if (cls.flags & C_COMMENT) {
+                        auto nl = (const char *)memchr(p + i, '\n', n - i);
+                        i = nl ? nl - p : n;
+                    }
+                    else if (cls.flags & C_OPEN) {
+                        if (toClose) toClose->push_back(_syntax.Close(cls.index));
+                        ++st.depth;
+                        ++i;
+                    }
+                    else if (cls.flags & C_CLOSE) {
+                        if (toClose) {
+                            if (toClose->back() != c) return n;
+                            toClose->pop_back();
+                        }
+                        if (st.depth > 0) --st.depth;
+                        ++i;
+                        if (toClose && st.depth == 0) return i;
+                    }
+                    else {
+                        st.quote = cls.index;
+                        st.multiline = i + 2 < n && p[i + 1] == c && p[i + 2] == c;
+                        st.pending = true;
+                        i += st.multiline ? 3 : 1;
+                    }
+                }
+                else {
+                    size_t e = i + _inside[st.quote].Find(p + i, n - i);
+                    // A '\r' ending the line is not part of it.
+                    if (e > i && !(e == i + 1 && p[i] == '\r' && e < n && p[e] == '\n')) {
+                        st.pending = false;
+                    }
+                    i = e;
+                    if (i >= n) break;
+
+                    char c = p[i];
+                    if (c == '\n') {
+                        // Otherwise only multi-line strings continue on the
+                        // next line.
+                        if (!st.multiline && !st.pending) st.quote = -1;
+                        ++i;
+                        ++lines;
+                        if (st.Clean() && i >= minEnd) return i;
+                    }
+                    else if (c == '\\') {
+                        // Steps over the escape, as long as it does not run
+                        // into the end of the line.
+                        ++i;
+                        auto lineEnd = [&](size_t k) {
+                            return k >= n || p[k] == '\n' || (p[k] == '\r' && k + 1 < n && p[k + 1] == '\n');
+                        };
+                        if (!lineEnd(i)) {
+                            if (p[i] == 'x' && !lineEnd(i + 1) && !lineEnd(i + 2)) i += 2;
+                            ++i;
+                        }
+                        st.pending = true;
+                    }
+                    else if (!st.multiline) {
+                        st.quote = -1;
+                        ++i;
+                    }
+                    else if (i + 2 < n && p[i + 1] == c && p[i + 2] == c) {
+                        st.quote = -1;
+                        st.multiline = false;
+                        i += 3;
+                    }
+                    else {
+                        ++i;
+                    }
+                }
+            }
+            return n;
+        }
+
+    public:
+        BoundaryScanner(const char * c_whitespace, const char * c_line_comment,
+                        const char * c_item_sep, const char * c_kv_sep,
+                        const char * c_quote, const char * c_open, const char * c_close)
+            : _syntax(c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                      c_quote, c_open, c_close) {
+            _outside.Add(c_line_comment);
+            _outside.Add(c_quote);
+            _outside.Add(c_open);
+            _outside.Add(c_close);
+            _outside.Add('\n');
+            for (const char * q = c_quote; *q; ++q) {
+                _inside.push_back(ByteScanner());
+                _inside.back().Add(*q);
+                _inside.back().Add('\\');
+                _inside.back().Add('\n');
+            }
+        }
+
+        // Scans p[from..n) onwards from st and returns the first clean line
+        // start at or after minEnd, or n. st is the state at the returned
+        // position.
+        size_t Scan(const char * p, size_t from, size_t n, size_t minEnd, State & st) const {
+            size_t lines = 0;
+            return Walk(p, from, n, minEnd, nullptr, st, lines);
+        }
+
+        // Returns the length of the alist opening at p[0] up to and
+        // including its closing bracket, or 0 if it is not properly closed
+        // within p[0..n). lines is set to the line breaks inside it.
+        size_t SkipAList(const char * p, size_t n, size_t & lines) const {
+            State st;
+            st.depth = 1;
+            lines = 0;
+            std::string toClose(1, _syntax.Close(_syntax.Class(p[0]).index));
+            size_t e = Walk(p, 1, n, SIZE_MAX, &toClose, st, lines);
+            return st.depth == 0 ? e : 0;
+        }
+    };
+
+    // Input range of a value, recorded by BasicParser::RecordSpans().
+    struct NodeSpan {
+        void *  node;   // as the builder returned it
+        size_t  begin;  // offset of its first byte
+        size_t  end;    // offset past its last byte
+        bool    top;    // a top-level value rather than a nested alist
+    };
+
+    // The alist state machine. Syntax is RuntimeSyntax or a StaticSyntax;
+    // Builder has the IOperator callbacks, and calls into a final class
+    // are resolved (and inlined) at compile time. IOperator itself is a
+    // valid Builder.
+    template<class Syntax, class Builder>
+    class BasicParser : public IParser {
+    private:
+
+        enum State {
+            STATE_ELEMENT_START = ParseStats::S_ELEMENT_START,
+            STATE_ELEMENT_END = ParseStats::S_ELEMENT_END,
+            STATE_ALIST = ParseStats::S_ALIST,
+            STATE_ALIST_WITH_KEY = ParseStats::S_ALIST_WITH_KEY,
+            STATE_QUOTED_STRING = ParseStats::S_QUOTED_STRING,
+            STATE_MULTILINE_STRING = ParseStats::S_MULTILINE_STRING
+        };
+
+        struct Value {
+            bool hasTmp;
+            void * tmp;
+            void * o;
+            bool isString;
+            bool isLiteral;
+            size_t begin;
+        };
+
+        bool            _multi;
+        bool            _sealed;
+        const char *    _in;
+        size_t          _limit;
+        size_t          _readPos;
+        size_t          _lineNum;
+        bool            _stable;
+        std::vector<Value> _valueStack;
+        std::vector<int>   _auxStack;
+        std::vector<State> _stateStack;
+        std::deque<void *> _results;
+        // Bytes held by _results, and what Feed() may hold.
+        size_t          _queuedBytes;
+        ParseLimits     _limits;
+        std::string     _scratch;
+        Builder *       _op;
+        Syntax          _syntax;
+        ParseStats      _stats;
+        std::vector<NodeSpan> * _spans;
+        size_t          _spanBase;
+        const char *    _spanData;
+        // Lazy mode: the scanner that finds the end of a nested alist, the
+        // end of the buffer being parsed, if any, and where to go on
+        // after an alist skipped past the end of the line.
+        const BoundaryScanner * _skip;
+        const char *    _bufEnd;
+        const char *    _resume;
+        IResultHandler * _handler;
+        // Feed(): the part of the current line not parsed yet, whether
+        // any of the line was, and how far it has been scanned for the end
+        // of a top-level alist (NONE once none can end on the line). The
+        // scan expects the closing brackets in _toClose, innermost last,
+        // and is inside a string if _quote is not -1.
+        std::string     _carry;
+        bool            _carryBegun;
+        size_t          _carryScan;
+        std::string     _toClose;
+        int             _quote;
+        bool            _multiline;
+
+        static const size_t NONE = SIZE_MAX;
+
+        // Counting hooks, compiled away unless ALIST_STATS is defined.
+        void Count(ParseStats::Callback c) {
+#ifdef ALIST_STATS
+            ++_stats.callbacks[c];
+#else
+            (void)c;
+#endif
+        }
+
+        void CountStep(State s) {
+#ifdef ALIST_STATS
+            ++_stats.steps[s];
+#else
+            (void)s;
+#endif
+        }
+
+        void CountDepth() {
+#ifdef ALIST_STATS
+            if (_valueStack.size() > _stats.maxDepth) _stats.maxDepth = _valueStack.size();
+#endif
+        }
+
+        void CountCompaction(size_t moved) {
+#ifdef ALIST_STATS
+            ++_stats.compactions;
+            _stats.bytesMoved += moved;
+#else
+            (void)moved;
+#endif
+        }
+
+        // Offset of pos on the current line from the start of the buffer
+        // last given to ParseBuffer() or ParseStable(), plus the base.
+        size_t Offset(size_t pos) const {
+            return _spanBase + (_in - _spanData) + pos;
+        }
+
+    public:
+
+        BasicParser(const Syntax & syntax, Builder * op, bool multi = true)
+            : _syntax(syntax)
+            {
+            _multi = multi;
+            _sealed = false;
+            _in = nullptr;
+            _limit = 0;
+            _readPos = 0;
+            _lineNum = 0;
+            _stable = false;
+            _stateStack.push_back(STATE_ELEMENT_START);
+            _op = op;
+            _spans = nullptr;
+            _spanBase = 0;
+            _spanData = nullptr;
+            _skip = nullptr;
+            _bufEnd = nullptr;
+            _resume = nullptr;
+            _handler = nullptr;
+            _queuedBytes = 0;
+            _carryBegun = false;
+            _carryScan = 0;
+            _quote = -1;
+            _multiline = false;
+        }
+
+        // Has nested alists in the buffers given to ParseBuffer(),
+        // ParseStable() and ParseFile() found with skip and passed to the
+        // builder's AListLazy() rather than parsed. Lines given to
+        // ParseLine() are still parsed in full.
+        void SetLazy(const BoundaryScanner * skip) {
+            _skip = skip;
+        }
+
+        // Appends to spans the range of every top-level value and nested
+        // alist completed from now on, as offsets into the buffers passed
+        // to ParseBuffer() or ParseStable(), each counted from base. A
+        // buffer continuing an earlier one needs base set again. Ranges
+        // are meaningless for input given to ParseLine() or Feed().
+        void RecordSpans(std::vector<NodeSpan> * spans, size_t base = 0) {
+            _spans = spans;
+            _spanBase = base;
+        }
+
+        // Offset where the top-level value still being parsed began (as
+        // for RecordSpans()), or SIZE_MAX if the parser is between values.
+        size_t Unfinished() const {
+            return _valueStack.empty() ? SIZE_MAX : _valueStack.front().begin;
+        }
+
+        void ParseLine(const std::string & line) override {
+            if (_sealed) return;
+
+            ++_lineNum;
+            _readPos = 0;
+            ParseBuf(line.data(), line.size());
+        }
+
+        void ParseBuffer(const char * data, size_t size) override {
+            ParseLines(data, size, false);
+        }
+
+        void ParseStable(const char * data, size_t size) override {
+            ParseLines(data, size, true);
+        }
+
+        void ParseFile(const char * path) override {
+            MappedFile f(path);
+            ParseLines(f.Data(), f.Size(), false);
+        }
+
+        size_t GetLineNumber() const override {
+            return _lineNum;
+        }
+
+        ParseStats GetStats() const override {
+            ParseStats stats = _stats;
+#ifdef ALIST_STATS
+            stats.lines = _lineNum;
+#endif
+            return stats;
+        }
+
+        FeedStatus Feed(const char * data, size_t size) override {
+            if (_sealed) return FEED_OK;
+            if (Full()) return FEED_WOULD_BLOCK;
+
+            const char * end = data + size;
+            try {
+                auto nl = (const char *)memchr(data, '\n', size);
+                if (nl) {
+                    const char * last = nl + 1;
+                    if (_carryBegun || !_carry.empty()) {
+                        _carry.append(data, nl - data);
+                        FinishLine();
+                        data = last;
+                    }
+                    while ((nl = (const char *)memchr(last, '\n', end - last))) last = nl + 1;
+                    if (last > data) ParseLines(data, last - data, false);
+                    data = last;
+                }
+                if (data != end && !_sealed) {
+                    size_t from = _carry.size() > 4 ? _carry.size() - 4 : 0;
+                    _carry.append(data, end - data);
+                    if (_carryScan != NONE) CutCarry(std::max(from, _carryScan));
+                    if (_limits.maxBuffered && _carry.size() > _limits.maxBuffered) {
+                        throw ParseException("line longer than the input limit");
+                    }
+                }
+            }
+            catch (...) {
+                DropCarry();
+                throw;
+            }
+            if (_sealed) DropCarry();
+            return FEED_OK;
+        }
+
+        void SetResultHandler(IResultHandler * handler) override {
+            _handler = handler;
+        }
+
+        void SetLimits(const ParseLimits & limits) override {
+            _limits = limits;
+        }
+
+        MemoryUsage GetMemoryUsage() const override {
+            MemoryUsage u;
+            u.buffered = _carry.capacity() + _toClose.capacity();
+            u.stacks = _valueStack.capacity() * sizeof(Value) +
+                _auxStack.capacity() * sizeof(int) +
+                _stateStack.capacity() * sizeof(State) +
+                _results.size() * sizeof(void *) +
+                _scratch.capacity();
+            u.building = _op->MemoryUsed(nullptr);
+            u.queued = _queuedBytes;
+            u.results = _results.size();
+            return u;
+        }
+
+        void Seal() override {
+            if (_sealed) return;
+
+            if (_carryBegun || !_carry.empty()) {
+                try {
+                    FinishLine();
+                }
+                catch (...) {
+                    DropCarry();
+                    Close();
+                    throw;
+                }
+            }
+            if (!_sealed) Close();
+        }
+
+        // Seal() without the line Feed() left unfinished, which is dropped
+        // when a single-value parser seals itself.
+        void Close() {
+            _sealed = true;
+            _readPos = 0;
+            ParseBuf("", 0);
+
+            _stateStack.clear();
+            for (auto && d : _valueStack) {
+                if (d.hasTmp) {
+                    Count(ParseStats::CB_FREE);
+                    _op->Free(d.tmp);
+                }
+                Count(ParseStats::CB_FREE);
+                _op->Free(d.o);
+            }
+            _valueStack.clear();
+        }
+
+        void Reset() override {
+            for (auto && d : _valueStack) {
+                if (d.hasTmp) _op->Free(d.tmp);
+                _op->Free(d.o);
+            }
+            for (auto d : _results) _op->Free(d);
+            _valueStack.clear();
+            _auxStack.clear();
+            _stateStack.clear();
+            _stateStack.push_back(STATE_ELEMENT_START);
+            _results.clear();
+            _queuedBytes = 0;
+            _limits = ParseLimits();
+            _scratch.clear();
+            _sealed = false;
+            _in = nullptr;
+            _limit = 0;
+            _readPos = 0;
+            _lineNum = 0;
+            _stable = false;
+            _bufEnd = nullptr;
+            _resume = nullptr;
+            _handler = nullptr;
+            DropCarry();
+            _stats = ParseStats();
+        }
+
+        ~BasicParser() {
+            DropCarry();
+            Seal();
+            for (auto d : _results) {
+                Count(ParseStats::CB_FREE);
+                _op->Free(d);
+            }
+        }
+
+        // Decodes the escape following a backslash into _scratch.
+        void DecodeEscape() {
+            switch (_in[_readPos]) {
+            case 'n':
+                _scratch.push_back('\n');
+                ++_readPos;
+                break;
+            case 't':
+                _scratch.push_back('\t');
+                ++_readPos;
+                break;
+            case 'r':
+                _scratch.push_back('\r');
+                ++_readPos;
+                break;
+            case 'f':
+                _scratch.push_back('\f');
+                ++_readPos;
+                break;
+            case 'x':
+            {
+                unsigned char c;
+                int digit;
+
+                if (_readPos + 2 >= _limit) goto InputError;
+                ++_readPos;
+                digit = detail::HexDigit(_in[_readPos]); if (digit < 0) goto InputError;
+                c = digit; ++_readPos;
+                digit = detail::HexDigit(_in[_readPos]); if (digit < 0) goto InputError;
+                c = (c << 4) + digit; ++_readPos;
+                _scratch.push_back(c);
+
+                break;
+
+            InputError:
+                throw ParseException("Expect 2 hex chars for utf-8 escape");
+            }
+            default:
+                _scratch.push_back(_in[_readPos]);
+                ++_readPos;
+                break;
+            }
+        }
+
+        // Decodes the run of escapes starting at the backslash at _readPos,
+        // along with the plain bytes between them, and passes it to the
+        // builder in one call. Bytes after the last escape are left to the
+        // string states; a backslash ending the line is dropped.
+        void HandleEscapes() {
+            auto && v = _valueStack.back();
+            int quote = _auxStack.back();
+
+            // The rest of the line bounds what this string can still grow by.
+            Count(ParseStats::CB_STRING_RESERVE);
+            v.o = _op->StringReserve(v.o, _limit - _readPos);
+            _scratch.clear();
+            while (_readPos < _limit && _in[_readPos] == '\\') {
+                if (++_readPos >= _limit) break;
+                DecodeEscape();
+                size_t e = _readPos + _syntax.FindQuoteEnd(quote, _in + _readPos, _limit - _readPos);
+                if (e >= _limit || _in[e] != '\\') break;
+                _scratch.append(_in + _readPos, e - _readPos);
+                _readPos = e;
+            }
+            Count(ParseStats::CB_STRING_APPEND);
+            v.o = _op->StringAppendByteArray(
+                v.o, (const unsigned char *)_scratch.data(), _scratch.size());
+        }
+
+        // Appends input bytes [b, e) to the string being built. Bytes from a
+        // stable buffer are passed by reference so the operator may keep them.
+        void * AppendRun(void * o, size_t b, size_t e) {
+            Count(ParseStats::CB_STRING_APPEND);
+            if (_stable) {
+                return _op->StringAppendRef(o, (const unsigned char *)_in + b, e - b);
+            }
+            else {
+                return _op->StringAppendByteArray(o, (const unsigned char *)_in + b, e - b);
+            }
+        }
+
+        // Appends the element held back in case a key separator followed
+        // it. This happens before the next element starts, so the builder
+        // sees the items of an alist in input order.
+        void FlushItem(Value & v) {
+            if (v.hasTmp) {
+                Count(ParseStats::CB_ALIST_APPEND_ITEM);
+                v.o = _op->AListAppendItem(v.o, v.tmp);
+                v.hasTmp = false;
+                v.tmp = nullptr;
+                v.isString = false;
+                v.isLiteral = false;
+            }
+        }
+
+        // Runs the state machine over each '\n'-terminated line of the
+        // buffer in place; a trailing '\r' is not part of the line.
+        void ParseLines(const char * data, size_t size, bool stable) {
+            if (_sealed) return;
+
+            const char * end = data + size;
+            _stable = stable;
+            _spanData = data;
+            _bufEnd = end;
+            try {
+                while (data < end && !_sealed) {
+                    auto nl = (const char *)memchr(data, '\n', end - data);
+                    size_t len = (nl ? nl : end) - data;
+                    if (len > 0 && data[len - 1] == '\r') --len;
+                    ++_lineNum;
+                    _readPos = 0;
+                    ParseBuf(data, len);
+                    if (_resume) {
+                        // The rest of the line a skipped alist ended on.
+                        data = _resume;
+                        _resume = nullptr;
+                        --_lineNum;
+                    }
+                    else {
+                        data = nl ? nl + 1 : end;
+                    }
+                }
+            }
+            catch (...) {
+                _stable = false;
+                _bufEnd = nullptr;
+                _resume = nullptr;
+                throw;
+            }
+            _stable = false;
+            _bufEnd = nullptr;
+        }
+
+        // Whether queued results are at a limit.
+        bool Full() const {
+            return !_handler &&
+                ((_limits.maxResults && _results.size() >= _limits.maxResults) ||
+                 (_limits.maxResultBytes && _queuedBytes >= _limits.maxResultBytes));
+        }
+
+        // Parses what _carry holds of the line up to the end of the last
+        // top-level alist in it, if any, and drops it. Only a closing
+        // bracket can end an alist, so the scan waits for one past from.
+        // It may have stopped short of one in the last bytes it had, which
+        // are looked at again.
+        void CutCarry(size_t from) {
+            if (_syntax.FindClose(_carry.data() + from, _carry.size() - from) == _carry.size() - from) return;
+
+            size_t cut = 0;
+            for (size_t c; (c = FindCut()) != 0; ) cut = c;
+            if (cut > 0) {
+                ParsePiece(cut);
+                _carry.erase(0, cut);
+                if (_carryScan != NONE) _carryScan -= cut;
+                CountCompaction(_carry.size());
+            }
+        }
+
+        // Parses _carry up to n as the start, or the next part, of the
+        // line Feed() is on.
+        void ParsePiece(size_t n) {
+            if (!_carryBegun) {
+                ++_lineNum;
+                _carryBegun = true;
+            }
+            _readPos = 0;
+            ParseBuf(_carry.data(), n);
+        }
+
+        // Parses the rest of the line Feed() is on, which is complete.
+        void FinishLine() {
+            size_t n = _carry.size();
+            if (n > 0 && _carry[n - 1] == '\r') --n;
+            ParsePiece(n);
+            DropCarry();
+        }
+
+        void DropCarry() {
+            _carry.clear();
+            _carryBegun = false;
+            _carryScan = 0;
+        }
+
+        // Scans _carry on from _carryScan for the closing bracket that
+        // ends the top-level alist open there, or the next one to open,
+        // and returns the offset just past it, or 0 if there is none. It
+        // follows the state machine as BoundaryScanner does, except that
+        // the line goes on past the end of _carry, so the scan stops short
+        // of a quote or escape whose extent is not known yet.
+        size_t FindCut() {
+            const char * p = _carry.data();
+            size_t n = _carry.size();
+            size_t i = _carryScan;
+            if (i == NONE || _stateStack.empty()) return 0;
+
+            if (i == 0) {
+                // The brackets open at the start of the line.
+                _toClose.clear();
+                for (size_t k = 0; k < _valueStack.size(); ++k) {
+                    if (_stateStack[k] == STATE_ALIST || _stateStack[k] == STATE_ALIST_WITH_KEY) {
+                        _toClose.push_back(_syntax.Close(_auxStack[k]));
+                    }
+                }
+                State top = _stateStack.back();
+                _quote = top == STATE_QUOTED_STRING || top == STATE_MULTILINE_STRING ? _auxStack.back() : -1;
+                _multiline = top == STATE_MULTILINE_STRING;
+            }
+
+            while (i < n) {
+                if (_quote < 0) {
+                    i += _syntax.FindStructure(p + i, n - i);
+                    if (i >= n) break;
+
+                    char c = p[i];
+                    CharClass cls = _syntax.Class(c);
+                    if (cls.flags & C_COMMENT) {
+                        _carryScan = NONE;
+                        return 0;
+                    }
+                    else if (cls.flags & C_OPEN) {
+                        _toClose.push_back(_syntax.Close(cls.index));
+                        ++i;
+                    }
+                    else if (cls.flags & C_CLOSE) {
+                        // A bracket the parser does not expect fails the line.
+                        if (_toClose.empty() || _toClose.back() != c) {
+                            _carryScan = NONE;
+                            return 0;
+                        }
+                        _toClose.pop_back();
+                        ++i;
+                        if (_toClose.empty()) {
+                            _carryScan = i;
+                            return i;
+                        }
+                    }
+                    else {
+                        if (i + 1 >= n || (p[i + 1] == c && i + 2 >= n)) break;
+                        _quote = cls.index;
+                        _multiline = p[i + 1] == c && p[i + 2] == c;
+                        i += _multiline ? 3 : 1;
+                    }
+                }
+                else {
+                    i += _syntax.FindQuoteEnd(_quote, p + i, n - i);
+                    if (i >= n) break;
+
+                    char c = p[i];
+                    if (c == '\\') {
+                        // What follows must be there, and not be a '\r'
+                        // the line may end with. A bad \x fails the line.
+                        if (i + 1 >= n || (p[i + 1] == '\r' && i + 2 >= n) ||
+                            (p[i + 1] == 'x' && i + 3 >= n)) break;
+                        i += p[i + 1] == 'x' ? 4 : 2;
+                    }
+                    else if (!_multiline) {
+                        _quote = -1;
+                        ++i;
+                    }
+                    else if (i + 2 >= n) {
+                        break;
+                    }
+                    else if (p[i + 1] == c && p[i + 2] == c) {
+                        _quote = -1;
+                        _multiline = false;
+                        i += 3;
+                    }
+                    else {
+                        ++i;
+                    }
+                }
+            }
+            _carryScan = i;
+            return 0;
+        }
+
+        // Hands the nested alist opening at s to the builder as text.
+        // False if it is not closed within the buffer or the builder
+        // declines it.
+        bool SkipAList(size_t s, int bracket) {
+            const char * p = _in + s;
+            size_t lines;
+            size_t n = _skip->SkipAList(p, _bufEnd - p, lines);
+            if (n == 0) return false;
+
+            Count(ParseStats::CB_ALIST_LAZY);
+            void * o = _op->AListLazy(p, n, !_stable);
+            if (o == nullptr) return false;
+
+            _valueStack.push_back(Value());
+            CountDepth();
+            auto && v = _valueStack.back();
+            v.hasTmp = false;
+            v.tmp = nullptr;
+            v.o = o;
+            v.isString = false;
+            v.isLiteral = false;
+            v.begin = _spans ? Offset(s) : 0;
+            _auxStack.push_back(bracket);
+            _stateStack.back() = STATE_ELEMENT_END;
+            if (lines == 0) {
+                _readPos = s + n;
+            }
+            else {
+                // Go on from the closing bracket's line, whose number
+                // ParseLines() advances to.
+                _readPos = _limit;
+                _resume = p + n;
+                _lineNum += lines;
+            }
+            return true;
+        }
+
+        void ParseBuf(const char * in, size_t limit) {
+#ifdef ALIST_STATS
+            // Adds the time spent to the stats however the run ends.
+            struct Timer {
+                ParseStats & stats;
+                std::chrono::steady_clock::time_point start;
+
+                ~Timer() {
+                    stats.parseNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+                }
+            } timer = { _stats, std::chrono::steady_clock::now() };
+            _stats.bytes += limit - _readPos;
+#endif
+            Run(in, limit);
+        }
+
+        void Run(const char * in, size_t limit) {
+            _in = in;
+            _limit = limit;
+            while (_readPos < limit || (_stateStack.size() > 0 && _stateStack.back() == STATE_ELEMENT_END)) {
+                if (_stateStack.size() == 0) {
+                    Close();
+                    return;
+                }
+
+                auto state = _stateStack.back();
+                CountStep(state);
+
+                switch (state) {
+                case STATE_ELEMENT_END: {
+                    auto value = _valueStack.back();
+
+                    _stateStack.pop_back();
+                    _auxStack.pop_back();
+                    _valueStack.pop_back();
+
+                    if (_stateStack.size() == 0) {
+                        Count(ParseStats::CB_DOCUMENT_FINALIZE);
+                        auto doc = _op->DocumentFinalize(value.o);
+                        if (doc) {
+                            if (_spans) _spans->push_back(NodeSpan{doc, value.begin, Offset(_readPos), true});
+                            if (_handler) {
+                                _handler->OnResult(doc);
+                            }
+                            else {
+                                _results.push_back(doc);
+                                _queuedBytes += _op->MemoryUsed(doc);
+                            }
+                        }
+
+                        if (_multi) {
+                            _stateStack.push_back(STATE_ELEMENT_START);
+                        }
+
+                        break;
+                    }
+
+                    switch (_stateStack.back()) {
+                    case STATE_ALIST:
+                    {
+                        auto && c = _valueStack.back();
+                        c.hasTmp = true;
+                        c.tmp = value.o;
+                        c.isString = value.isString;
+                        c.isLiteral = value.isLiteral;
+                        break;
+                    }
+
+                    case STATE_ALIST_WITH_KEY:
+                    {
+                        auto && c = _valueStack.back();
+                        Count(ParseStats::CB_ALIST_APPEND_KV);
+                        _op->AListAppendKV(c.o, c.tmp, c.isLiteral, value.o);
+                        c.hasTmp = false;
+                        c.tmp = nullptr;
+                        c.isString = false;
+                        c.isLiteral = false;
+                        _stateStack.back() = STATE_ALIST;
+                        break;
+                    }
+
+                    default:
+                        throw ParseException("invalid state to insert element");
+                    }
+                    break;
+                }
+                case STATE_QUOTED_STRING: {
+                    auto && v = _valueStack.back();
+                    size_t s = _readPos + _syntax.FindQuoteEnd(_auxStack.back(), _in + _readPos, limit - _readPos);
+                    v.o = AppendRun(v.o, _readPos, s);
+
+                    if (s >= limit) {
+                        _readPos = limit;
+                        Count(ParseStats::CB_STRING_FINALIZE);
+                        v.o = _op->StringFinalize(v.o);
+                        _stateStack.back() = STATE_ELEMENT_END;
+                    }
+                    else {
+                        if (_in[s] == '\\') {
+                            _readPos = s;
+                            HandleEscapes();
+                        }
+                        else {
+                            _readPos = s + 1;
+                            Count(ParseStats::CB_STRING_FINALIZE);
+                            v.o = _op->StringFinalize(v.o);
+                            _stateStack.back() = STATE_ELEMENT_END;
+                        }
+                    }
+                    break;
+                }
+                case STATE_MULTILINE_STRING: {
+                    auto && v = _valueStack.back();
+                    char delim = _syntax.Quote(_auxStack.back());
+                    size_t s = _readPos + _syntax.FindQuoteEnd(_auxStack.back(), _in + _readPos, limit - _readPos);
+                    v.o = AppendRun(v.o, _readPos, s);
+
+                    if (s >= limit) {
+                        Count(ParseStats::CB_STRING_APPEND);
+                        v.o = _op->StringAppendByte(v.o, '\n');
+                        _readPos = limit;
+                    }
+                    else {
+                        if (_in[s] == '\\') {
+                            _readPos = s;
+                            HandleEscapes();
+                        }
+                        else if (s + 2 < limit && _in[s] == delim && _in[s + 1] == delim && _in[s + 2] == delim) {
+                            Count(ParseStats::CB_STRING_FINALIZE);
+                            v.o = _op->StringFinalize(v.o);
+                            _readPos = s + 3;
+                            _stateStack.back() = STATE_ELEMENT_END;
+                        }
+                        else {
+                            v.o = AppendRun(v.o, s, s + 1);
+                            _readPos = s + 1;
+                        }
+                    }
+                    break;
+                }
+                case STATE_ALIST: {
+                    auto && v = _valueStack.back();
+                    size_t s = _readPos + _syntax.SkipWhitespace(_in + _readPos, limit - _readPos);
+
+                    if (s >= limit) {
+                        _readPos = limit;
+                    }
+                    else if (_in[s] == _syntax.Close(_auxStack.back())) {
+                        FlushItem(v);
+                        Count(ParseStats::CB_ALIST_FINALIZE);
+                        v.o = _op->AListFinalize(v.o);
+                        _stateStack.back() = STATE_ELEMENT_END;
+                        _readPos = s + 1;
+                        if (_spans && _valueStack.size() > 1) {
+                            _spans->push_back(NodeSpan{v.o, v.begin, Offset(_readPos), false});
+                        }
+                    }
+                    else if (_syntax.Class(_in[s]).flags & C_ITEM_SEP) {
+                        FlushItem(v);
+                        _readPos = s + 1;
+                        _stateStack.push_back(STATE_ELEMENT_START);
+                    }
+                    else if (_syntax.Class(_in[s]).flags & C_KV_SEP) {
+                        if (!v.hasTmp) {
+                            throw ParseException("missing key element before '='");
+                        }
+                        else if (!v.isString && !v.isLiteral) {
+                            throw ParseException("key element must be literal or string");
+                        }
+                        Count(ParseStats::CB_ALIST_KEY);
+                        v.tmp = _op->AListKey(v.o, v.tmp, v.isLiteral);
+                        _readPos = s + 1;
+                        _stateStack.back() = STATE_ALIST_WITH_KEY;
+                        _stateStack.push_back(STATE_ELEMENT_START);
+                    }
+                    else if (_syntax.Class(_in[s]).flags & C_COMMENT) {
+                        _readPos = limit;
+                    }
+                    else {
+                        FlushItem(v);
+                        _readPos = s;
+                        _stateStack.push_back(STATE_ELEMENT_START);
+                    }
+
+                    break;
+
+                }
+                case STATE_ELEMENT_START: {
+                    size_t s = _readPos + _syntax.SkipWhitespace(_in + _readPos, limit - _readPos);
+                    CharClass cls = s < limit ? _syntax.Class(_in[s]) : CharClass();
+
+                    if (s >= limit) {
+                        _readPos = limit;
+                    }
+                    else if (cls.flags & C_OPEN) {
+                        if (_skip && _bufEnd && !_valueStack.empty() && SkipAList(s, cls.index)) break;
+
+                        _valueStack.push_back(Value());
+                        CountDepth();
+                        auto && v = _valueStack.back();
+                        v.hasTmp = false;
+                        v.tmp = nullptr;
+                        Count(ParseStats::CB_ALIST_NEW);
+                        v.o = _op->AListNew();
+                        v.isString = false;
+                        v.isLiteral = false;
+                        v.begin = _spans ? Offset(s) : 0;
+                        _stateStack.back() = STATE_ALIST;
+                        _auxStack.push_back(cls.index);
+                        _readPos = s + 1;
+                    }
+                    else if (cls.flags & C_QUOTE) {
+                        _valueStack.push_back(Value());
+                        CountDepth();
+                        auto && v = _valueStack.back();
+                        v.hasTmp = false;
+                        v.tmp = nullptr;
+                        Count(ParseStats::CB_STRING_NEW);
+                        v.o = _op->StringNew();
+                        v.isString = true;
+                        v.isLiteral = false;
+                        v.begin = _spans ? Offset(s) : 0;
+                        _auxStack.push_back(cls.index);
+
+                        if (s + 2 < limit &&
+                            _in[s + 1] == _in[s] && _in[s + 2] == _in[s]) {
+                            _stateStack.back() = STATE_MULTILINE_STRING;
+                            _readPos = s + 3;
+                        }
+                        else {
+                            _stateStack.back() = STATE_QUOTED_STRING;
+                            _readPos = s + 1;
+                        }
+                    }
+                    else if (_syntax.Class(_in[s]).flags & C_COMMENT) {
+                        _readPos = limit;
+                    }
+                    else {
+                        size_t e = s + _syntax.FindSpecial(_in + s, limit - s);
+
+                        if (e == s) {
+                            throw ParseException("unexpected char at element start");
+                        }
+
+                        _valueStack.push_back(Value());
+                        CountDepth();
+                        auto && v = _valueStack.back();
+                        v.hasTmp = false;
+                        v.tmp = nullptr;
+                        Count(ParseStats::CB_LITERAL_NEW);
+                        v.o = _stable ? _op->LiteralRef(_in + s, e - s)
+                                      : _op->LiteralNew(_in + s, e - s);
+                        v.isString = false;
+                        v.isLiteral = true;
+                        v.begin = _spans ? Offset(s) : 0;
+
+                        _auxStack.push_back(0);
+                        _stateStack.back() = STATE_ELEMENT_END;
+                        _readPos = e;
+                    }
+
+                    break;
+                }
+                case STATE_ALIST_WITH_KEY:
+                    // The value of the pair is always being parsed on top.
+                    throw ParseException("invalid state to read element");
+                }
+            }
+        }
+
+        void * Extract() override {
+            if (_results.size() > 0) {
+                auto v = _results.front();
+                _results.pop_front();
+                _queuedBytes -= std::min(_queuedBytes, _op->MemoryUsed(v));
+                return v;
+            }
+            else {
+                return nullptr;
+            }
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,104 @@
+#include "alist.hpp"
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace alist;
+using namespace std;
+
+struct ParserPool::State {
+    // Idle parsers. Shards sit on cache lines of their own so threads
+    // working on different ones do not slow each other down.
+    struct alignas(64) Shard {
+        mutex               lock;
+        vector<IParser *>   idle;
+    };
+
+    bool                multi;
+    string              chars[7];
+    unique_ptr<Shard[]> shards;
+    size_t              count;
+
+    Shard & Home() {
+        return shards[hash<thread::id>()(this_thread::get_id()) % count];
+    }
+};
+
+ParserPool::ParserPool(bool multi,
+                       const char * c_whitespace,
+                       const char * c_line_comment,
+                       const char * c_item_sep,
+                       const char * c_kv_sep,
+                       const char * c_quote,
+                       const char * c_open,
+                       const char * c_close)
+    : _state(new State()) {
+    _state->multi = multi;
+    const char * chars[] = { c_whitespace, c_line_comment, c_item_sep, c_kv_sep,
+                             c_quote, c_open, c_close };
+    for (int i = 0; i < 7; ++i) _state->chars[i] = chars[i];
+    _state->count = max(4u, thread::hardware_concurrency());
+    _state->shards.reset(new State::Shard[_state->count]);
+}
+
+ParserPool::~ParserPool() {
+    for (size_t i = 0; i < _state->count; ++i) {
+        for (auto p : _state->shards[i].idle) delete p;
+    }
+    delete _state;
+}
+
+void ParserPool::Recycler::operator()(IParser * parser) const {
+    if (parser == nullptr) return;
+    if (_pool == nullptr) {
+        delete parser;
+        return;
+    }
+    parser->Reset();
+    auto && shard = _pool->_state->Home();
+    lock_guard<mutex> g(shard.lock);
+    shard.idle.push_back(parser);
+}
+
+ParserPool::Handle ParserPool::Acquire() {
+    // The thread's own shard first; a shard that is busy or empty is
+    // passed over rather than waited for.
+    State & st = *_state;
+    size_t home = &st.Home() - st.shards.get();
+    for (size_t i = 0; i < st.count; ++i) {
+        auto && shard = st.shards[(home + i) % st.count];
+        unique_lock<mutex> g(shard.lock, try_to_lock);
+        if (g.owns_lock() && !shard.idle.empty()) {
+            auto p = shard.idle.back();
+            shard.idle.pop_back();
+            return Handle(p, Recycler(this));
+        }
+    }
+
+    auto && c = st.chars;
+    return Handle(CreateParser(nullptr, st.multi, c[0].c_str(), c[1].c_str(), c[2].c_str(),
+                               c[3].c_str(), c[4].c_str(), c[5].c_str(), c[6].c_str()),
+                  Recycler(this));
+}
+
+vector<unique_ptr<const IData>> ParserPool::Parse(const char * data, size_t size) {
+    auto parser = Acquire();
+    parser->ParseBuffer(data, size);
+    parser->Seal();
+
+    vector<unique_ptr<const IData>> results;
+    while (auto d = parser->ExtractData()) results.push_back(move(d));
+    return results;
+}
+
+size_t ParserPool::Idle() const {
+    size_t n = 0;
+    for (size_t i = 0; i < _state->count; ++i) {
+        lock_guard<mutex> g(_state->shards[i].lock);
+        n += _state->shards[i].idle.size();
+    }
+    return n;
+}
@@ -0,0 +1,181 @@
+#include "alist.hpp"
+#include "alist_query.hpp"
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace alist;
+using namespace std;
+
+void Query::Program::Compile(const Slice & path) {
+    size_t i = 0, n = path.size();
+    auto fail = [&](const char * what) {
+        throw invalid_argument(string(what) + " at offset " + to_string(i) +
+                               " of query '" + string(path) + "'");
+    };
+
+    // Reads "[...]" at i into s.
+    auto bracket = [&](Step & s) {
+        ++i;
+        if (i < n && path[i] == '*') {
+            ++i;
+        }
+        else if (i < n && (path[i] == '"' || path[i] == '\'')) {
+            char quote = path[i++];
+            s.kind = KEY;
+            while (i < n && path[i] != quote) {
+                if (path[i] == '\\' && i + 1 < n) ++i;
+                s.key.push_back(path[i++]);
+            }
+            if (i == n) fail("unterminated key");
+            ++i;
+        }
+        else if (i < n && path[i] >= '0' && path[i] <= '9') {
+            s.kind = INDEX;
+            for (; i < n && path[i] >= '0' && path[i] <= '9'; ++i) {
+                size_t digit = path[i] - '0';
+                if (s.index > (SIZE_MAX - digit) / 10) fail("index too large");
+                s.index = s.index * 10 + digit;
+            }
+        }
+        else {
+            fail("expected index, key or '*'");
+        }
+        if (i == n || path[i] != ']') fail("expected ']'");
+        ++i;
+    };
+
+    // Reads the key or "*" at i into s.
+    auto name = [&](Step & s) {
+        size_t from = i;
+        while (i < n && path[i] != '.' && path[i] != '[' && path[i] != ']') ++i;
+        if (i == from) fail("expected key");
+        s.key.assign(path.data() + from, i - from);
+        s.kind = s.key == "*" ? ANY : KEY;
+    };
+
+    while (i < n) {
+        Step s{ANY, false, string(), 0};
+        if (path[i] == '.') {
+            ++i;
+            if (i < n && path[i] == '.') {
+                s.descend = true;
+                ++i;
+            }
+            if (i < n && path[i] == '[') bracket(s);
+            else name(s);
+        }
+        else if (path[i] == '[') {
+            bracket(s);
+        }
+        else if (steps.empty()) {
+            name(s);
+        }
+        else {
+            fail("expected '.' or '['");
+        }
+        if (s.kind == ANY) s.key.clear();
+        steps.push_back(s);
+    }
+    if (steps.size() >= UINT32_MAX) fail("too many steps");
+}
+
+void Query::Program::Eval(const IData * d, vector<const IData *> & out, size_t max) const {
+    // One frame per alist walked into: its positions, in pos[begin, end),
+    // and the next of its items, followed by its pairs, to visit.
+    struct Frame {
+        const IData *   d;
+        size_t          begin;
+        size_t          end;
+        size_t          next;
+        size_t          items;
+        size_t          size;
+    };
+    vector<Frame> stack;
+    vector<Position> pos;
+    size_t found = 0;
+
+    // Reports v if it matches at the positions from begin to the end of
+    // pos, and walks into it if any of them goes on.
+    auto visit = [&](const IData * v, size_t begin) {
+        if (v && Matches(pos, begin, pos.size())) {
+            out.push_back(v);
+            ++found;
+        }
+        if (v && begin < pos.size() && pos[begin].step < steps.size() &&
+            v->GetType() == IData::T_ALIST) {
+            size_t items = v->Size();
+            stack.push_back(Frame{v, begin, pos.size(), 0, items, items + v->KVSize()});
+        }
+        else {
+            pos.resize(begin);
+        }
+    };
+
+    pos.push_back(Position{0, false});
+    visit(d, 0);
+    while (!stack.empty() && found < max) {
+        Frame f = stack.back();
+
+        // A lone position that does not descend leads to at most one
+        // child, which the alist can look up without a scan.
+        if (f.end - f.begin == 1 && f.next == 0) {
+            auto && s = steps[pos[f.begin].step];
+            if (!s.descend && s.kind != ANY) {
+                uint32_t p = pos[f.begin].step;
+                stack.pop_back();
+                pos.resize(f.begin);
+                pos.push_back(Position{p + 1, false});
+                visit(s.kind == KEY ? f.d->Find(Slice(s.key)) : f.d->At(s.index), f.begin);
+                continue;
+            }
+        }
+
+        if (f.next == f.size) {
+            stack.pop_back();
+            pos.resize(f.begin);
+            continue;
+        }
+
+        size_t i = stack.back().next++;
+        size_t from = pos.size();
+        const IData * child;
+        if (i < f.items) {
+            child = f.d->At(i);
+            Advance(pos, f.begin, f.end, nullptr, i);
+        }
+        else {
+            Slice key = f.d->KeyAt(i - f.items);
+            child = f.d->ValueAt(i - f.items);
+            Advance(pos, f.begin, f.end, &key, 0);
+        }
+        // May push a frame, so f is stale past this point.
+        visit(child, from);
+    }
+}
+
+Query::Query(const Slice & path)
+    : _program(new Program()) {
+    try {
+        _program->Compile(path);
+    }
+    catch (...) {
+        delete _program;
+        throw;
+    }
+}
+
+Query::~Query() {
+    delete _program;
+}
+
+void Query::Eval(const IData * d, vector<const IData *> & out) const {
+    _program->Eval(d, out, SIZE_MAX);
+}
+
+const IData * Query::First(const IData * d) const {
+    vector<const IData *> out;
+    _program->Eval(d, out, 1);
+    return out.empty() ? nullptr : out[0];
+}
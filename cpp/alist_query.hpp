@@ -0,0 +1,352 @@
+#ifndef __ALIST_QUERY__
+#define __ALIST_QUERY__
+
+#include "alist.hpp"
+#include "alist_data.hpp"
+#include <cstdint>
+#include <list>
+#include <string>
+#include <vector>
+
+namespace alist {
+
+    // Compiled steps of a Query. A value is reached at position i when the
+    // first i steps lead to it, and matches at position steps.size(); both
+    // evaluators track the sorted set of positions each value is reached
+    // at, which holds more than one only below a descending step.
+    struct Query::Program {
+        enum Kind {
+            KEY,
+            INDEX,
+            ANY
+        };
+
+        struct Step {
+            Kind        kind;
+            // Set for "..": the step is also tried from every value below.
+            bool        descend;
+            std::string key;
+            size_t      index;
+        };
+
+        struct Position {
+            uint32_t    step;
+            // Set on a key position once a pair of the alist has matched
+            // it, so that only the first pair with the key does.
+            bool        taken;
+        };
+
+        std::vector<Step> steps;
+
+        void Compile(const Slice & path);
+        void Eval(const IData * d, std::vector<const IData *> & out, size_t max) const;
+
+        bool Matches(const std::vector<Position> & v, size_t begin, size_t end) const {
+            return begin < end && v[end - 1].step == steps.size();
+        }
+
+        // Appends to v the positions a child is reached at, given the
+        // positions of its alist in v[begin, end). key is nullptr for the
+        // positional item index.
+        void Advance(std::vector<Position> & v, size_t begin, size_t end,
+                     const Slice * key, size_t index) const {
+            for (size_t i = begin; i < end; ++i) {
+                uint32_t p = v[i].step;
+                if (p == steps.size()) continue;
+
+                auto && s = steps[p];
+                if (s.descend) Add(v, end, p);
+                bool hit;
+                switch (s.kind) {
+                case KEY:
+                    hit = key && !v[i].taken && *key == Slice(s.key);
+                    if (hit) v[i].taken = true;
+                    break;
+                case INDEX:
+                    hit = !key && index == s.index;
+                    break;
+                default:
+                    hit = true;
+                    break;
+                }
+                if (hit) Add(v, end, p + 1);
+            }
+        }
+
+        // Positions come out in order, so duplicates are adjacent.
+        static void Add(std::vector<Position> & v, size_t from, uint32_t p) {
+            if (v.size() == from || v.back().step != p) v.push_back(Position{p, false});
+        }
+    };
+
+    // Scalar the streaming evaluator reports without building it.
+    class ScalarView final : public IData {
+    private:
+        Type                _type;
+        Slice               _text;
+        mutable std::string _str;
+
+    public:
+        ScalarView(Type type, const Slice & text) : _type(type), _text(text) { }
+
+        Type GetType() const override { return _type; }
+        const std::string & GetString() const override {
+            _str.assign(_text.data(), _text.size());
+            return _str;
+        }
+        Slice GetSlice() const override { return _text; }
+        const std::list<const IData *> & GetList() const override {
+            static const std::list<const IData *> none;
+            return none;
+        }
+        const std::list<std::pair<std::string, const IData *>> & GetKVList() const override {
+            static const std::list<std::pair<std::string, const IData *>> none;
+            return none;
+        }
+        size_t Size() const override { return 0; }
+        size_t KVSize() const override { return 0; }
+    };
+
+    // Builder that evaluates a query as the parser goes. Outside the
+    // values that match, nothing is built: alists are tokens tracked by
+    // their frames, and a scalar's text is kept only while its alist can
+    // still lead to a match. An alist that matches is built, with all it
+    // holds, by _builder; matches inside it are held in _matches until it
+    // is complete, then reported in the order they began.
+    class QueryOperator final : public IOperator {
+    private:
+        typedef Query::Program::Position Position;
+
+        static const size_t NONE = SIZE_MAX;
+
+        struct Frame {
+            // Positions the alist is reached at, in _positions.
+            size_t  begin;
+            size_t  end;
+            size_t  items;
+            // Between AListKey() and AListAppendKV(): the positions of the
+            // value follow, up to the end of _positions.
+            bool    keyed;
+            // Where the alist goes in _matches when it matches.
+            size_t  slot;
+        };
+
+        const Query::Program &  _program;
+        IMatchHandler *         _handler;
+        std::vector<Position>   _positions;
+        std::vector<Frame>      _frames;
+        ParseOperator           _builder;
+        // Frame of the alist being built, or NONE.
+        size_t                  _build;
+        std::vector<const IData *> _matches;
+        // Last scalar, when it was worth keeping.
+        std::string             _buf;
+        Slice                   _text;
+        bool                    _literal;
+        // Distinct tokens standing in for values on the parser stacks.
+        char                    _list;
+        char                    _scalar;
+
+        void * List() { return &_list; }
+        void * Scalar() { return &_scalar; }
+
+        bool Building() const { return _build != NONE; }
+
+        // Whether a scalar of the current alist may be needed, as a key
+        // or a match.
+        bool Live() const {
+            return _frames.empty() || _frames.back().begin < _frames.back().end;
+        }
+
+        bool IsScalar(void * v) {
+            return Building() ? ((Data *)v)->GetType() != IData::T_ALIST : v == Scalar();
+        }
+
+        // Reports, or holds until the value being built is complete, the
+        // scalar v.
+        void ScalarMatch(void * v) {
+            if (Building()) {
+                _matches.push_back((Data *)v);
+            }
+            else {
+                ScalarView s(_literal ? IData::T_LITERAL : IData::T_STRING, _text);
+                _handler->OnMatch(&s);
+            }
+        }
+
+    public:
+        QueryOperator(const Query & query, IMatchHandler * handler)
+            : _program(*query._program)
+            , _handler(handler)
+            , _build(NONE)
+            , _literal(false)
+            , _list(0)
+            , _scalar(0)
+            { }
+
+        void * AListNew() override {
+            size_t begin = _positions.size();
+            if (_frames.empty()) {
+                _positions.push_back(Position{0, false});
+            }
+            else {
+                auto && f = _frames.back();
+                if (f.keyed) {
+                    begin = f.end;
+                }
+                else {
+                    _positions.resize(f.end);
+                    begin = f.end;
+                    _program.Advance(_positions, f.begin, f.end, nullptr, f.items);
+                }
+            }
+
+            size_t end = _positions.size();
+            size_t slot = NONE;
+            if (_program.Matches(_positions, begin, end)) {
+                if (!Building()) _build = _frames.size();
+                slot = _matches.size();
+                _matches.push_back(nullptr);
+            }
+            _frames.push_back(Frame{begin, end, 0, false, slot});
+            return Building() ? _builder.AListNew() : List();
+        }
+
+        void * AListAppendItem(void * d, void * i) override {
+            auto && f = _frames.back();
+            size_t index = f.items++;
+            if (Live() && IsScalar(i)) {
+                size_t from = _positions.size();
+                _program.Advance(_positions, f.begin, f.end, nullptr, index);
+                if (_program.Matches(_positions, from, _positions.size())) ScalarMatch(i);
+                _positions.resize(from);
+            }
+            return Building() ? _builder.AListAppendItem(d, i) : d;
+        }
+
+        void * AListKey(void * d, void * key, bool isLiteral) override {
+            auto && f = _frames.back();
+            _positions.resize(f.end);
+            f.keyed = true;
+            if (f.begin < f.end) {
+                Slice k = Building() ? ((Data *)key)->GetSlice() : _text;
+                _program.Advance(_positions, f.begin, f.end, &k, 0);
+            }
+            return Building() ? _builder.AListKey(d, key, isLiteral) : key;
+        }
+
+        void * AListAppendKV(void * d, void * key, bool isLiteral, void * value) override {
+            auto && f = _frames.back();
+            if (IsScalar(value) && _program.Matches(_positions, f.end, _positions.size())) {
+                ScalarMatch(value);
+            }
+            _positions.resize(f.end);
+            f.keyed = false;
+            return Building() ? _builder.AListAppendKV(d, key, isLiteral, value) : d;
+        }
+
+        void * AListFinalize(void * d) override {
+            Frame f = _frames.back();
+            if (Building()) {
+                d = _builder.AListFinalize(d);
+                if (f.slot != NONE) _matches[f.slot] = (Data *)d;
+                if (_build == _frames.size() - 1) {
+                    auto doc = (Data *)_builder.DocumentFinalize(d);
+                    _matches[0] = doc;
+                    for (auto m : _matches) _handler->OnMatch(m);
+                    delete doc;
+                    _matches.clear();
+                    _build = NONE;
+                    d = List();
+                }
+            }
+            _positions.resize(f.begin);
+            _frames.pop_back();
+            return d;
+        }
+
+        void * StringNew() override {
+            if (Building()) return _builder.StringNew();
+            _buf.clear();
+            _text = Slice();
+            _literal = false;
+            return Scalar();
+        }
+
+        void * StringAppendByte(void * d, unsigned char b) override {
+            if (Building()) return _builder.StringAppendByte(d, b);
+            if (Live()) _buf.push_back(b);
+            return d;
+        }
+
+        void * StringAppendByteArray(void * d, const unsigned char * b, int l) override {
+            if (Building()) return _builder.StringAppendByteArray(d, b, l);
+            if (Live()) _buf.append((const char *)b, l);
+            return d;
+        }
+
+        void * StringAppendRef(void * d, const unsigned char * b, int l) override {
+            if (Building()) return _builder.StringAppendRef(d, b, l);
+            if (Live()) _buf.append((const char *)b, l);
+            return d;
+        }
+
+        void * StringReserve(void * d, size_t n) override {
+            return Building() ? _builder.StringReserve(d, n) : d;
+        }
+
+        void * StringFinalize(void * d) override {
+            if (Building()) return _builder.StringFinalize(d);
+            _text = Slice(_buf);
+            return d;
+        }
+
+        void * LiteralNew(const char * str, int len) override {
+            if (Building()) return _builder.LiteralNew(str, len);
+            if (Live()) {
+                _buf.assign(str, len);
+                _text = Slice(_buf);
+                _literal = true;
+            }
+            return Scalar();
+        }
+
+        void * LiteralRef(const char * str, int len) override {
+            if (Building()) return _builder.LiteralRef(str, len);
+            if (Live()) {
+                _text = Slice(str, len);
+                _literal = true;
+            }
+            return Scalar();
+        }
+
+        void * Free(void * /*d*/) override {
+            // Only called for what is left on the parser stacks when it is
+            // sealed or reset; nodes of an unfinished match stay in the
+            // builder's arena, which the next match reuses.
+            _positions.clear();
+            _frames.clear();
+            _matches.clear();
+            _build = NONE;
+            return nullptr;
+        }
+
+        // Only a match being built holds anything.
+        size_t MemoryUsed(void * d) override {
+            return d ? 0 : _builder.MemoryUsed(nullptr);
+        }
+
+        void Reset() {
+            Free(nullptr);
+            _builder.Reset();
+        }
+
+        void * DocumentFinalize(void * d) override {
+            if (d == Scalar() && _program.steps.empty()) ScalarMatch(d);
+            _handler->OnDocumentEnd();
+            return nullptr;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,122 @@
+#include "alist.hpp"
+#include <charconv>
+#include <cstdint>
+#include <system_error>
+
+using namespace alist;
+using namespace std;
+
+// Powers of ten a double holds exactly.
+static const double POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+IData::Scalar IData::Decode(const Slice & s) {
+    Scalar r;
+    const char * p = s.begin();
+    const char * end = s.end();
+    if (p == end) return r;
+
+    switch (*p) {
+    case 'n':
+        if (s == Slice("null")) r.kind = K_NULL;
+        return r;
+    case 't':
+    case 'f':
+        if (s == Slice("true") || s == Slice("false")) {
+            r.kind = K_BOOL;
+            r.b = *p == 't';
+        }
+        return r;
+    default:
+        break;
+    }
+
+    // Checks the syntax, keeping the first 19 significant digits in m;
+    // the number is m * 10^exp10, give or take the digits dropped.
+    bool neg = *p == '-';
+    if (neg) ++p;
+    uint64_t m = 0;
+    int digits = 0;
+    int64_t exp10 = 0;
+    bool integral = true;
+
+    if (p < end && *p == '0') {
+        ++p;
+    }
+    else if (p < end && IsDigit(*p)) {
+        for (; p < end && IsDigit(*p); ++p) {
+            if (digits < 19) m = m * 10 + (*p - '0');
+            else ++exp10;
+            ++digits;
+        }
+    }
+    else {
+        return r;
+    }
+
+    if (p < end && *p == '.') {
+        integral = false;
+        const char * frac = ++p;
+        for (; p < end && IsDigit(*p); ++p) {
+            if (digits == 0 && *p == '0') {
+                --exp10;
+            }
+            else if (digits < 19) {
+                m = m * 10 + (*p - '0');
+                --exp10;
+                ++digits;
+            }
+            else {
+                ++digits;
+            }
+        }
+        if (p == frac) return r;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        integral = false;
+        ++p;
+        bool eneg = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) ++p;
+        if (p == end || !IsDigit(*p)) return r;
+        int64_t e = 0;
+        for (; p < end && IsDigit(*p); ++p) {
+            // Far beyond the range of double either way.
+            if (e < 100000) e = e * 10 + (*p - '0');
+        }
+        exp10 += eneg ? -e : e;
+    }
+    if (p != end) return r;
+
+    if (integral && digits <= 19) {
+        const uint64_t limit = (uint64_t)INT64_MAX + (neg ? 1 : 0);
+        if (m <= limit) {
+            r.kind = K_INT;
+            r.i = neg ? (int64_t)(0 - m) : (int64_t)m;
+            return r;
+        }
+    }
+
+    // Clinger's fast path: m and 10^|exp10| are both exact as doubles, so
+    // one correctly rounded operation gives the correctly rounded result.
+    if (digits <= 19 && m <= (uint64_t)1 << 53 && exp10 >= -22 && exp10 <= 22) {
+        double f = (double)m;
+        f = exp10 < 0 ? f / POW10[-exp10] : f * POW10[exp10];
+        r.kind = K_FLOAT;
+        r.f = neg ? -f : f;
+        return r;
+    }
+
+    double f;
+    auto res = from_chars(s.begin(), s.end(), f);
+    if (res.ec != errc() || res.ptr != s.end()) return r;
+    r.kind = K_FLOAT;
+    r.f = f;
+    return r;
+}
@@ -0,0 +1,200 @@
+#include "alist_scan.hpp"
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define ALIST_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace alist;
+
+#ifdef ALIST_SCAN_X86
+
+static bool HasAVX2() {
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+}
+
+// The vector routines return the index of the first hit, or the number
+// of bytes covered by whole vectors when there is none; the caller
+// finishes the tail byte by byte.
+
+static size_t FindEqSSE2(const unsigned char * chars, int count,
+                         const char * p, size_t n, bool negate) {
+    __m128i c[16];
+    for (int k = 0; k < count; ++k) c[k] = _mm_set1_epi8((char)chars[k]);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i m = _mm_setzero_si128();
+        for (int k = 0; k < count; ++k) {
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(x, c[k]));
+        }
+        unsigned mask = _mm_movemask_epi8(m);
+        if (negate) mask = ~mask & 0xffff;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t FindEqAVX2(const unsigned char * chars, int count,
+                         const char * p, size_t n, bool negate) {
+    __m256i c[16];
+    for (int k = 0; k < count; ++k) c[k] = _mm256_set1_epi8((char)chars[k]);
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i m = _mm256_setzero_si256();
+        for (int k = 0; k < count; ++k) {
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, c[k]));
+        }
+        unsigned mask = _mm256_movemask_epi8(m);
+        if (negate) mask = ~mask;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t FindNibbleAVX2(const unsigned char * lo, const unsigned char * hi,
+                             const char * p, size_t n, bool negate) {
+    const __m256i loTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lo));
+    const __m256i hiTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hi));
+    const __m256i low4 = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i l = _mm256_shuffle_epi8(loTable, _mm256_and_si256(x, low4));
+        __m256i h = _mm256_shuffle_epi8(hiTable, _mm256_and_si256(_mm256_srli_epi16(x, 4), low4));
+        // Set where the byte is NOT in the set.
+        __m256i out = _mm256_cmpeq_epi8(_mm256_and_si256(l, h), zero);
+        unsigned mask = _mm256_movemask_epi8(out);
+        if (!negate) mask = ~mask;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i;
+}
+
+// A byte below 32 is one that min(x, 31) leaves unchanged.
+static size_t FindEscapeSSE2(const char * p, size_t n, char quote) {
+    const __m128i control = _mm_set1_epi8(31);
+    const __m128i del = _mm_set1_epi8(127);
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i q = _mm_set1_epi8(quote);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(x, control), x), _mm_cmpeq_epi8(x, del)),
+            _mm_or_si128(_mm_cmpeq_epi8(x, backslash), _mm_cmpeq_epi8(x, q)));
+        unsigned mask = _mm_movemask_epi8(m);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t FindEscapeAVX2(const char * p, size_t n, char quote) {
+    const __m256i control = _mm256_set1_epi8(31);
+    const __m256i del = _mm256_set1_epi8(127);
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i q = _mm256_set1_epi8(quote);
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(x, control), x), _mm256_cmpeq_epi8(x, del)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, backslash), _mm256_cmpeq_epi8(x, q)));
+        unsigned mask = _mm256_movemask_epi8(m);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i;
+}
+
+#endif
+
+size_t alist::FindEscape(const char * p, size_t n, char quote) {
+    size_t i = 0;
+#ifdef ALIST_SCAN_X86
+    if (n >= 32 && HasAVX2()) {
+        i = FindEscapeAVX2(p, n, quote);
+    }
+    else if (n >= 16) {
+        i = FindEscapeSSE2(p, n, quote);
+    }
+#endif
+    for (; i < n; ++i) {
+        unsigned char c = p[i];
+        if (c < 32 || c == 127 || c == '\\' || c == (unsigned char)quote) break;
+    }
+    return i;
+}
+
+ByteScanner::ByteScanner()
+    : _set("", false, true)
+    , _count(0)
+    , _nibble(true) {
+    memset(_chars, 0, sizeof(_chars));
+    memset(_lo, 0, sizeof(_lo));
+    memset(_hi, 0, sizeof(_hi));
+}
+
+void ByteScanner::Add(const char * v) {
+    while (*v) Add(*v++);
+}
+
+void ByteScanner::Add(char ch) {
+    unsigned char c = ch;
+    if (_set[c]) return;
+    _set.m[c] = true;
+
+    if (_count < 16) _chars[_count] = c;
+    ++_count;
+
+    // Give each distinct high nibble its own bit; more than 8 of them
+    // cannot be told apart with 8-bit table entries.
+    if (_nibble && _hi[c >> 4] == 0) {
+        int used = 0;
+        for (int i = 0; i < 16; ++i) if (_hi[i]) ++used;
+        if (used == 8) _nibble = false;
+        else _hi[c >> 4] = 1 << used;
+    }
+    if (_nibble) _lo[c & 15] |= _hi[c >> 4];
+}
+
+size_t ByteScanner::Find(const char * p, size_t n) const {
+    size_t i = 0;
+#ifdef ALIST_SCAN_X86
+    if (n >= 32 && HasAVX2() && (_nibble || _count <= 16)) {
+        i = _nibble ? FindNibbleAVX2(_lo, _hi, p, n, false)
+                    : FindEqAVX2(_chars, _count, p, n, false);
+    }
+    else if (n >= 16 && _count <= 16) {
+        i = FindEqSSE2(_chars, _count, p, n, false);
+    }
+#endif
+    while (i < n && !_set[p[i]]) ++i;
+    return i;
+}
+
+size_t ByteScanner::FindNot(const char * p, size_t n) const {
+    size_t i = 0;
+#ifdef ALIST_SCAN_X86
+    if (n >= 32 && HasAVX2() && (_nibble || _count <= 16)) {
+        i = _nibble ? FindNibbleAVX2(_lo, _hi, p, n, true)
+                    : FindEqAVX2(_chars, _count, p, n, true);
+    }
+    else if (n >= 16 && _count <= 16) {
+        i = FindEqSSE2(_chars, _count, p, n, true);
+    }
+#endif
+    while (i < n && _set[p[i]]) ++i;
+    return i;
+}
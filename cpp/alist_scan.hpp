@@ -0,0 +1,100 @@
+#ifndef __ALIST_SCAN__
+#define __ALIST_SCAN__
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+namespace alist {
+
+    template<typename I>
+    struct CharMap {
+        I m[256];
+
+        explicit CharMap(I defaultValue) {
+            for (int i = 0; i < 256; ++i) m[i] = defaultValue;
+        }
+
+        CharMap(const char * v, I defaultValue, I setValue) {
+            for (int i = 0; i < 256; ++i) m[i] = defaultValue;
+            Set(v, setValue);
+        }
+
+        CharMap(const char * v, I defaultValue, const std::initializer_list<I> & l) {
+            for (int i = 0; i < 256; ++i) m[i] = defaultValue;
+            auto it = l.begin();
+            while (*v && it != l.end()) {
+                m[(unsigned char)*v] = *it;
+                ++v; ++it;
+            }
+        }
+
+        void Set(const char * v, I value) {
+            while (*v) {
+                m[(unsigned char)*v] = value;
+                ++v;
+            }
+        }
+
+        const I & operator[](unsigned char c) const {
+            return m[c];
+        }
+    };
+
+    enum {
+        C_WHITESPACE    = 1 << 0,
+        C_COMMENT       = 1 << 1,
+        C_ITEM_SEP      = 1 << 2,
+        C_KV_SEP        = 1 << 3,
+        C_QUOTE         = 1 << 4,
+        C_OPEN          = 1 << 5,
+        C_CLOSE         = 1 << 6
+    };
+
+    // Entry of a byte classification table: the delimiter sets a byte
+    // belongs to, and its position in the open or quote set.
+    struct CharClass {
+        unsigned char flags;
+        unsigned char index;
+
+        constexpr CharClass() : flags(0), index(0) { }
+        constexpr CharClass(unsigned char f, unsigned char i) : flags(f), index(i) { }
+    };
+
+    // Finds the next byte inside (or outside) a fixed byte set. Long runs
+    // are scanned 16 or 32 bytes at a time with SSE2/AVX2, picked at run
+    // time; other targets and oversized sets use the lookup table.
+    class ByteScanner {
+    private:
+        CharMap<bool>   _set;
+        unsigned char   _chars[16];
+        int             _count;
+        // Nibble tables for the AVX2 path: byte c is in the set iff
+        // _lo[c & 15] & _hi[c >> 4] is non-zero.
+        unsigned char   _lo[16];
+        unsigned char   _hi[16];
+        bool            _nibble;
+
+    public:
+        ByteScanner();
+
+        void Add(const char * v);
+        void Add(char c);
+
+        bool Contains(char c) const {
+            return _set[c];
+        }
+
+        // Index of the first byte of p[0..n) in the set, or n.
+        size_t Find(const char * p, size_t n) const;
+        // Index of the first byte of p[0..n) not in the set, or n.
+        size_t FindNot(const char * p, size_t n) const;
+    };
+
+    // Index of the first byte of p[0..n) that cannot appear as is between
+    // quote characters: control bytes, DEL, the backslash and quote
+    // itself. n if there is none.
+    size_t FindEscape(const char * p, size_t n, char quote);
+}
+
+#endif
@@ -0,0 +1,195 @@
+#include "alist.hpp"
+#include "alist_scan.hpp"
+#include <vector>
+#include <cerrno>
+#include <unistd.h>
+
+using namespace alist;
+using namespace std;
+
+// Output is built in a string and handed to the file descriptor or stream,
+// if any, whenever it grows past this.
+static const size_t FLUSH_SIZE = 64 * 1024;
+
+static const char HEX[] = "0123456789abcdef";
+
+static void WriteAll(int fd, const char * p, size_t n) {
+    while (n > 0) {
+        ssize_t w = ::write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            throw runtime_error("write failed");
+        }
+        p += w;
+        n -= w;
+    }
+}
+
+static void Flush(string & out, int fd, ostream * os) {
+    if (fd >= 0) {
+        WriteAll(fd, out.data(), out.size());
+        out.clear();
+    }
+    else if (os) {
+        os->write(out.data(), out.size());
+        out.clear();
+    }
+}
+
+// Quotes s, escaping the quote and the backslash with a backslash and
+// control bytes as \xHH; bytes from 128 up are written as they are. Runs that need no escaping are
+// found a vector at a time and copied whole.
+static void WriteQuoted(string & out, const Slice & s, char quote) {
+    out.push_back(quote);
+    const char * p = s.data();
+    size_t n = s.size();
+    while (n > 0) {
+        size_t run = FindEscape(p, n, quote);
+        out.append(p, run);
+        if (run == n) break;
+
+        unsigned char c = p[run];
+        if (c == quote || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        }
+        else {
+            char esc[4] = { '\\', 'x', HEX[c >> 4], HEX[c & 0xf] };
+            out.append(esc, 4);
+        }
+        p += run + 1;
+        n -= run + 1;
+    }
+    out.push_back(quote);
+}
+
+Serializer::Serializer(bool pretty, int indent,
+                       const char * c_whitespace, const char * c_line_comment,
+                       const char * c_item_sep, const char * c_kv_sep,
+                       const char * c_quote, const char * c_open, const char * c_close)
+    : _pretty(pretty)
+    , _indent(indent)
+    , _itemSep(c_item_sep[0])
+    , _kvSep(c_kv_sep[0])
+    , _quote(c_quote[0])
+    , _open(c_open[0])
+    , _close(c_close[0])
+    , _special(new ByteScanner()) {
+    _special->Add(c_whitespace);
+    _special->Add(c_line_comment);
+    _special->Add(c_item_sep);
+    _special->Add(c_kv_sep);
+    _special->Add(c_quote);
+    _special->Add(c_open);
+    _special->Add(c_close);
+    _special->Add('\r');
+    _special->Add('\n');
+}
+
+Serializer::~Serializer() {
+    delete _special;
+}
+
+void Serializer::Write(string & out, const IData * d, int fd, ostream * os) const {
+    // One frame per open alist: the next of its items, followed by its
+    // key/value pairs, to write.
+    struct Frame {
+        const IData *   d;
+        size_t          next;
+        size_t          items;
+        size_t          size;
+    };
+    vector<Frame> stack;
+
+    auto newline = [&](size_t depth) {
+        out.push_back('\n');
+        out.append(depth * _indent, ' ');
+    };
+
+    auto literal = [&](const Slice & s) {
+        if (s.empty() || _special->Find(s.data(), s.size()) < s.size()) {
+            WriteQuoted(out, s, _quote);
+        }
+        else {
+            out.append(s.data(), s.size());
+        }
+    };
+
+    // Writes a scalar, or opens an alist and pushes its frame.
+    auto value = [&](const IData * v) {
+        if (v == nullptr) {
+            out.append("(NULL)");
+            return;
+        }
+        switch (v->GetType()) {
+        case IData::T_UNKNOWN:
+            out.append("(UNKNOWN)");
+            break;
+        case IData::T_LITERAL:
+            literal(v->GetSlice());
+            break;
+        case IData::T_STRING:
+            WriteQuoted(out, v->GetSlice(), _quote);
+            break;
+        case IData::T_ALIST: {
+            out.push_back(_open);
+            size_t items = v->Size();
+            size_t size = items + v->KVSize();
+            if (size == 0) out.push_back(_close);
+            else stack.push_back(Frame{v, 0, items, size});
+            break;
+        }
+        }
+    };
+
+    value(d);
+    while (!stack.empty()) {
+        if (out.size() >= FLUSH_SIZE) Flush(out, fd, os);
+
+        Frame & f = stack.back();
+        if (f.next == f.size) {
+            stack.pop_back();
+            if (_pretty) newline(stack.size());
+            out.push_back(_close);
+            continue;
+        }
+
+        if (f.next > 0) out.push_back(_itemSep);
+        if (_pretty) newline(stack.size());
+
+        size_t i = f.next++;
+        const IData * child;
+        if (i < f.items) {
+            child = f.d->At(i);
+        }
+        else {
+            literal(f.d->KeyAt(i - f.items));
+            if (_pretty) {
+                out.push_back(' ');
+                out.push_back(_kvSep);
+                out.push_back(' ');
+            }
+            else {
+                out.push_back(_kvSep);
+            }
+            child = f.d->ValueAt(i - f.items);
+        }
+        // May push a frame, so f is not used past this point.
+        value(child);
+    }
+    Flush(out, fd, os);
+}
+
+void Serializer::Write(string & out, const IData * d) const {
+    Write(out, d, -1, nullptr);
+}
+
+void Serializer::Write(int fd, const IData * d) const {
+    string out;
+    Write(out, d, fd, nullptr);
+}
+
+void Serializer::Write(ostream & o, const IData * d) const {
+    string out;
+    Write(out, d, -1, &o);
+}
@@ -0,0 +1,150 @@
+// ApplyPatch(a, Diff(a, b)) gives b, over random trees and random changes
+// to them.
+#include "test.hpp"
+#include <random>
+#include <utility>
+
+using namespace alist;
+using namespace std;
+
+namespace {
+    struct Node {
+        enum Kind { LITERAL, STRING, ALIST } kind;
+        string text;
+        vector<Node> items;
+        vector<pair<string, Node>> pairs;
+    };
+
+    struct Gen {
+        mt19937 rng;
+
+        explicit Gen(unsigned seed) : rng(seed) { }
+
+        size_t Pick(size_t n) { return rng() % n; }
+
+        Node Scalar() {
+            static const char * literals[] = { "a", "b", "42", "-1.5e3", "true", "null", "x_y" };
+            static const char * strings[] = { "s p", "tab\\there", "q\\\"uote", "", "[not]" };
+            Node n;
+            if (Pick(3)) {
+                n.kind = Node::LITERAL;
+                n.text = literals[Pick(7)];
+            }
+            else {
+                n.kind = Node::STRING;
+                n.text = strings[Pick(5)];
+            }
+            return n;
+        }
+
+        string Key() {
+            return "k" + to_string(Pick(8));
+        }
+
+        Node Tree(int depth) {
+            if (depth == 0 || Pick(4) == 0) return Scalar();
+            Node n;
+            n.kind = Node::ALIST;
+            size_t items = Pick(5), pairs = Pick(5);
+            for (size_t i = 0; i < items; ++i) n.items.push_back(Tree(depth - 1));
+            for (size_t i = 0; i < pairs; ++i) {
+                // Duplicate keys now and then, which Diff() replaces whole.
+                string k = Key();
+                bool dup = false;
+                for (auto && p : n.pairs) dup = dup || p.first == k;
+                if (!dup || Pick(10) == 0) n.pairs.push_back(make_pair(k, Tree(depth - 1)));
+            }
+            return n;
+        }
+
+        void Alists(Node & n, vector<Node *> & out) {
+            if (n.kind != Node::ALIST) return;
+            out.push_back(&n);
+            for (auto && i : n.items) Alists(i, out);
+            for (auto && p : n.pairs) Alists(p.second, out);
+        }
+
+        void Mutate(Node & root) {
+            vector<Node *> alists;
+            Alists(root, alists);
+            Node & n = *alists[Pick(alists.size())];
+            size_t ni = n.items.size(), np = n.pairs.size();
+            switch (Pick(8)) {
+            case 0: if (ni) n.items[Pick(ni)] = Tree(2); break;
+            case 1: n.items.insert(n.items.begin() + Pick(ni + 1), Tree(2)); break;
+            case 2: if (ni) n.items.erase(n.items.begin() + Pick(ni)); break;
+            case 3: if (ni > 1) swap(n.items[Pick(ni)], n.items[Pick(ni)]); break;
+            case 4: n.pairs.insert(n.pairs.begin() + Pick(np + 1), make_pair(Key(), Tree(2))); break;
+            case 5: if (np) n.pairs.erase(n.pairs.begin() + Pick(np)); break;
+            case 6: if (np) n.pairs[Pick(np)].second = Tree(2); break;
+            case 7: if (np > 1) swap(n.pairs[Pick(np)], n.pairs[Pick(np)]); break;
+            }
+        }
+    };
+
+    void Write(string & out, const Node & n) {
+        if (n.kind == Node::LITERAL) out += n.text;
+        else if (n.kind == Node::STRING) out += "\"" + n.text + "\"";
+        else {
+            out += "[";
+            const char * sep = "";
+            for (auto && i : n.items) {
+                out += sep;
+                Write(out, i);
+                sep = ", ";
+            }
+            for (auto && p : n.pairs) {
+                out += sep + p.first + " = ";
+                Write(out, p.second);
+                sep = ", ";
+            }
+            out += "]";
+        }
+    }
+
+    unique_ptr<const IData> Parse(const string & text) {
+        unique_ptr<IParser> p(CreateParser());
+        p->ParseBuffer(text.data(), text.size());
+        auto docs = test::Drain(p.get());
+        CHECK(docs.size() == 1);
+        return docs.empty() ? nullptr : std::move(docs[0]);
+    }
+
+    string Text(const Node & n) {
+        string out;
+        Write(out, n);
+        return out;
+    }
+}
+
+int main() {
+    for (unsigned seed = 0; seed < 500; ++seed) {
+        Gen gen(seed);
+        Node na = gen.Tree(4);
+        if (na.kind != Node::ALIST) continue;
+        Node nb = na;
+        for (size_t k = 1 + gen.Pick(4); k > 0; --k) gen.Mutate(nb);
+
+        auto a = Parse(Text(na));
+        auto b = Parse(Text(nb));
+        if (!a || !b) continue;
+
+        CHECK(Diff(a.get(), a.get())->Size() == 0);
+        auto patch = Diff(a.get(), b.get());
+
+        // Applied as Diff() made it, and as read back from its text.
+        auto c = Parse(Text(na));
+        ApplyPatch(const_cast<IData *>(c.get()), patch.get());
+        if (!CHECK(Equal(c.get(), b.get()))) {
+            cerr << "  seed " << seed << ": " << Text(na) << " -> " << Text(nb)
+                 << " by " << test::Text(patch.get()) << " gives " << test::Text(c.get()) << endl;
+        }
+
+        auto readBack = Parse(test::Text(patch.get()));
+        auto d = Parse(Text(na));
+        ApplyPatch(const_cast<IData *>(d.get()), readBack.get());
+        CHECK(Equal(d.get(), b.get()));
+    }
+
+    return test::Result();
+}
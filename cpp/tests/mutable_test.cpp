@@ -0,0 +1,186 @@
+// MutableDocument snapshots stay as they were taken while edits are made,
+// committed or dropped, and readers on other threads see whole commits.
+#include "test.hpp"
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+using namespace alist;
+using namespace std;
+
+typedef MutableDocument::Path Path;
+
+static unique_ptr<const IData> Parse(const char * text) {
+    unique_ptr<IParser> p(CreateParser());
+    p->ParseLine(text);
+    auto docs = test::Drain(p.get());
+    return docs.empty() ? nullptr : std::move(docs[0]);
+}
+
+static void Isolation() {
+    MutableDocument doc(Parse("[count=0, mirror=0, items=[a], nested=[x=[y=1]]]"));
+    auto s0 = doc.Get();
+    string t0 = test::Text(s0.get());
+
+    {
+        auto e = doc.Begin();
+        e.Set(Path{"count"}, Slice("1"));
+        e.Insert(Path{"items", 1}, Slice("b"));
+        e.Set(Path{"nested", "x", "y"}, Slice("2"));
+        CHECK(test::Text(e.Get()) == "[count=1,mirror=0,items=[a,b],nested=[x=[y=2]]]");
+        // Not seen before it is committed.
+        CHECK(doc.Get() == s0);
+        CHECK(doc.Version() == 0);
+        auto s1 = e.Commit();
+        CHECK(doc.Get() == s1);
+        CHECK(doc.Version() == 1);
+        CHECK(test::Text(s1.get()) == "[count=1,mirror=0,items=[a,b],nested=[x=[y=2]]]");
+        // Nodes the edit did not change are shared.
+        CHECK(s1->Find("mirror") == s0->Find("mirror"));
+    }
+    CHECK(test::Text(s0.get()) == t0);
+
+    {
+        // Dropped without a commit.
+        auto e = doc.Begin();
+        e.Remove(Path{"items", 0});
+    }
+    CHECK(doc.Version() == 1);
+    CHECK(test::Text(doc.Get().get()) == "[count=1,mirror=0,items=[a,b],nested=[x=[y=2]]]");
+
+    {
+        // Committing nothing publishes nothing.
+        auto e = doc.Begin();
+        CHECK(e.Commit() == doc.Get());
+        CHECK(doc.Version() == 1);
+    }
+
+    MutableDocument::Reader reader(doc);
+    CHECK(reader.Get() == doc.Get().get());
+    {
+        auto e = doc.Begin();
+        e.Remove(Path{"items", 0}, 2);
+        e.Commit();
+    }
+    CHECK(test::Text(reader.Get()) == "[count=1,mirror=0,items=[],nested=[x=[y=2]]]");
+    CHECK(test::Text(s0.get()) == t0);
+}
+
+// A path whose keys are gone by the time it is used.
+static Path KeysOf(const vector<string> & keys) {
+    Path path;
+    for (auto && k : keys) {
+        string scoped = k;
+        path.push_back(Slice(scoped));
+    }
+    path.push_back(string("y"));
+    return path;
+}
+
+static void PathKeys() {
+    MutableDocument doc(Parse("[nested=[x=[y=1]]]"));
+    Path path = KeysOf({"nested", "x"});
+    auto e = doc.Begin();
+    e.Set(path, Slice("3"));
+    CHECK(test::Text(e.Commit().get()) == "[nested=[x=[y=3]]]");
+}
+
+// A change that throws leaves the edit as it was.
+static void BadPaths() {
+    MutableDocument doc(Parse("[a=[1, 2], s=x]"));
+    auto s0 = doc.Get();
+    auto value = Parse("v");
+    auto threw = [](function<void()> f) {
+        try {
+            f();
+        }
+        catch (const out_of_range &) {
+            return true;
+        }
+        return false;
+    };
+
+    {
+        auto e = doc.Begin();
+        CHECK(threw([&]() { e.Set(Path{"missing"}, Slice("1")); }));
+        CHECK(threw([&]() { e.Set(Path{"a", 5}, value.get()); }));
+        CHECK(threw([&]() { e.Insert(Path{"s", 0}, Slice("1")); }));
+        CHECK(threw([&]() { e.Insert(Path{"a", 3}, value.get()); }));
+        CHECK(threw([&]() { e.Remove(Path{"a", 1}, 2); }));
+        CHECK(threw([&]() { e.Remove(Path{"b"}); }));
+        CHECK(e.Get() == s0.get());
+        CHECK(e.Commit() == s0);
+        CHECK(doc.Version() == 0);
+    }
+
+    {
+        // After a change that worked, the edit keeps it.
+        auto e = doc.Begin();
+        e.Set(Path{"s"}, Slice("y"));
+        CHECK(threw([&]() { e.Set(Path{"a", "k"}, Slice("1")); }));
+        CHECK(test::Text(e.Commit().get()) == "[a=[1,2],s=y]");
+        CHECK(doc.Version() == 1);
+    }
+
+    {
+        // A patch keeps the operations before the one that throws.
+        auto patch = Parse("[[set, [s], z], [del, [a, 9]], [set, [a, 0], 0]]");
+        auto e = doc.Begin();
+        CHECK(threw([&]() { e.Apply(patch.get()); }));
+        CHECK(test::Text(e.Commit().get()) == "[a=[1,2],s=z]");
+        CHECK(doc.Version() == 2);
+    }
+    CHECK(test::Text(s0.get()) == "[a=[1,2],s=x]");
+}
+
+// Readers check that count and mirror, which every commit sets together,
+// always agree, while a writer commits enough to compact the tree.
+static void Concurrent() {
+    MutableDocument doc(Parse("[count=0, mirror=0, log=[]]"));
+    auto s0 = doc.Get();
+    string t0 = test::Text(s0.get());
+    atomic<bool> done(false);
+    atomic<int> torn(0);
+
+    vector<thread> readers;
+    for (int r = 0; r < 3; ++r) {
+        readers.emplace_back([&]() {
+            MutableDocument::Reader reader(doc);
+            while (!done.load()) {
+                auto d = reader.Get();
+                auto count = d->Find("count");
+                auto log = d->Find("log");
+                if (count->GetSlice() != d->Find("mirror")->GetSlice() ||
+                    to_string(log->Size()) != string(count->GetSlice())) {
+                    ++torn;
+                }
+            }
+        });
+    }
+
+    const int commits = 2000;
+    for (int i = 1; i <= commits; ++i) {
+        auto e = doc.Begin();
+        string n = to_string(i);
+        e.Set(Path{"count"}, Slice(n));
+        e.Insert(Path{"log", (size_t)i - 1}, Slice("entry-" + n));
+        e.Set(Path{"mirror"}, Slice(n));
+        e.Commit();
+    }
+    done = true;
+    for (auto && t : readers) t.join();
+
+    CHECK(torn.load() == 0);
+    CHECK(doc.Version() == (uint64_t)commits);
+    CHECK(doc.Get()->Find("log")->Size() == (size_t)commits);
+    CHECK(test::Text(s0.get()) == t0);
+}
+
+int main() {
+    Isolation();
+    PathKeys();
+    BadPaths();
+    Concurrent();
+    return test::Result();
+}
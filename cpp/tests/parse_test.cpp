@@ -0,0 +1,106 @@
+// Every way of parsing the corpus gives what ParseLine() gives.
+#include "test.hpp"
+#include <cstdio>
+#include <fstream>
+
+using namespace alist;
+using namespace std;
+
+static test::Docs ByLine(IParser * parser, const string & text) {
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t nl = text.find('\n', pos);
+        if (nl == string::npos) nl = text.size();
+        parser->ParseLine(text.substr(pos, nl - pos));
+        pos = nl + 1;
+    }
+    return test::Drain(parser);
+}
+
+static test::Docs ByFeed(IParser * parser, const string & text, size_t chunk) {
+    for (size_t pos = 0; pos < text.size(); pos += chunk) {
+        CHECK(parser->Feed(text.data() + pos, min(chunk, text.size() - pos)) == IParser::FEED_OK);
+    }
+    return test::Drain(parser);
+}
+
+static void Compare(const char * mode, const test::Docs & want, const test::Docs & got) {
+    bool same = CHECK(got.size() == want.size());
+    for (size_t i = 0; same && i < want.size(); ++i) {
+        same = CHECK(test::Text(got[i].get()) == test::Text(want[i].get())) &&
+               CHECK(Equal(got[i].get(), want[i].get()));
+    }
+    if (!same) cerr << "  in mode " << mode << endl;
+}
+
+int main(int argc, char ** argv) {
+    auto corpus = test::Corpus(argc > 1 ? argv[1] : "../tests");
+    string all;
+    for (auto && text : corpus) all += text;
+    corpus.push_back(all);
+
+    for (auto && text : corpus) {
+        unique_ptr<IParser> p(CreateParser());
+        auto want = ByLine(p.get(), text);
+        CHECK(!want.empty());
+
+        p.reset(CreateParser());
+        p->ParseBuffer(text.data(), text.size());
+        Compare("buffer", want, test::Drain(p.get()));
+
+        p.reset(CreateParser());
+        p->ParseStable(text.data(), text.size());
+        Compare("stable", want, test::Drain(p.get()));
+
+        const char * path = "parse_test_input.txt";
+        ofstream(path, ios::binary).write(text.data(), text.size());
+        p.reset(CreateParser());
+        p->ParseFile(path);
+        Compare("file", want, test::Drain(p.get()));
+        remove(path);
+
+        for (size_t chunk : {1, 2, 5, 13, 64, 4096}) {
+            p.reset(CreateParser());
+            Compare("feed", want, ByFeed(p.get(), text, chunk));
+        }
+
+        p.reset(CreateParallelParser(4));
+        p->ParseBuffer(text.data(), text.size());
+        Compare("parallel", want, test::Drain(p.get()));
+
+        p.reset(CreateParallelParser(4));
+        Compare("parallel feed", want, ByFeed(p.get(), text, 7));
+
+        p.reset(CreateLazyParser());
+        p->ParseBuffer(text.data(), text.size());
+        Compare("lazy", want, test::Drain(p.get()));
+
+        p.reset(CreateLazyParser());
+        p->ParseStable(text.data(), text.size());
+        Compare("lazy stable", want, test::Drain(p.get()));
+
+        p.reset(CreateTypedParser());
+        p->ParseBuffer(text.data(), text.size());
+        Compare("typed", want, test::Drain(p.get()));
+
+        KeyTable keys;
+        p.reset(CreateParser(keys));
+        p->ParseBuffer(text.data(), text.size());
+        Compare("keys", want, test::Drain(p.get()));
+
+        SubtreeTable trees;
+        p.reset(CreateParser(trees));
+        p->ParseBuffer(text.data(), text.size());
+        Compare("subtrees", want, test::Drain(p.get()));
+
+        IncrementalDocument inc(text);
+        CHECK(inc.ErrorLine() == 0);
+        // The documents stay owned by inc; only their text is compared.
+        for (size_t i = 0; i < inc.Size(); ++i) {
+            CHECK(test::Text(inc.At(i)) == (i < want.size() ? test::Text(want[i].get()) : ""));
+        }
+        CHECK(inc.Size() == want.size());
+    }
+
+    return test::Result();
+}
@@ -0,0 +1,49 @@
+// Serializer output and the binary format read back into the same trees.
+#include "test.hpp"
+#include <cstring>
+
+using namespace alist;
+using namespace std;
+
+static test::Docs Parse(const string & text) {
+    unique_ptr<IParser> p(CreateParser());
+    p->ParseBuffer(text.data(), text.size());
+    return test::Drain(p.get());
+}
+
+int main(int argc, char ** argv) {
+    for (auto && text : test::Corpus(argc > 1 ? argv[1] : "../tests")) {
+        auto docs = Parse(text);
+        CHECK(!docs.empty());
+
+        for (bool pretty : {false, true}) {
+            Serializer s(pretty);
+            string out;
+            for (auto && d : docs) {
+                s.Write(out, d.get());
+                out.push_back('\n');
+            }
+            auto back = Parse(out);
+            if (CHECK(back.size() == docs.size())) {
+                for (size_t i = 0; i < docs.size(); ++i) CHECK(Equal(back[i].get(), docs[i].get()));
+            }
+        }
+
+        BinaryEncoder enc;
+        for (auto && d : docs) enc.Add(d.get());
+        string bin;
+        enc.Finish(bin);
+        // BinaryDocument reads 32-bit words in place.
+        vector<uint32_t> words((bin.size() + 3) / 4);
+        memcpy(words.data(), bin.data(), bin.size());
+        BinaryDocument doc((const char *)words.data(), bin.size());
+        if (CHECK(doc.Size() == docs.size())) {
+            for (size_t i = 0; i < docs.size(); ++i) {
+                CHECK(Equal(doc.At(i), docs[i].get()));
+                CHECK(test::Text(doc.At(i)) == test::Text(docs[i].get()));
+            }
+        }
+    }
+
+    return test::Result();
+}
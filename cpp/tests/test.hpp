@@ -0,0 +1,96 @@
+#ifndef __ALIST_TEST__
+#define __ALIST_TEST__
+
+#include "alist.hpp"
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Checks for the test programs: a failed CHECK is reported and counted,
+// and the program exits with the number of failures.
+namespace test {
+    inline int & Failures() {
+        static int n = 0;
+        return n;
+    }
+
+    inline bool Check(bool ok, const char * what, const char * file, int line) {
+        if (!ok) {
+            std::cerr << file << ":" << line << ": failed: " << what << std::endl;
+            ++Failures();
+        }
+        return ok;
+    }
+
+    inline int Result() {
+        if (Failures()) std::cerr << Failures() << " check(s) failed" << std::endl;
+        return Failures() ? 1 : 0;
+    }
+
+    typedef std::vector<std::unique_ptr<const alist::IData>> Docs;
+
+    // Seals parser and extracts what it produced.
+    inline Docs Drain(alist::IParser * parser) {
+        parser->Seal();
+        Docs docs;
+        while (auto d = parser->ExtractData()) docs.push_back(std::move(d));
+        return docs;
+    }
+
+    // Compact text of d, as Dump() writes it.
+    inline std::string Text(const alist::IData * d) {
+        std::string out;
+        alist::Serializer().Write(out, d);
+        return out;
+    }
+
+    inline std::string ReadFile(const std::string & path) {
+        std::ifstream f(path, std::ios::binary);
+        std::ostringstream s;
+        s << f.rdbuf();
+        return s.str();
+    }
+
+    // Inputs every test runs over: the examples in dir, the repository's
+    // tests directory passed as the first argument, and inline cases for
+    // escapes, quoting, multi-line strings and comments.
+    inline std::vector<std::string> Corpus(const char * dir) {
+        std::vector<std::string> corpus;
+        for (int i = 0; i < 4; ++i) {
+            std::string text = ReadFile(std::string(dir) + "/ex" + std::to_string(i) + ".txt");
+            Check(!text.empty(), "example file read", __FILE__, __LINE__);
+            corpus.push_back(text);
+        }
+        corpus.push_back(
+            "[k1 = \"tab\\there\", k2 = 'single \\'quoted\\'', u = \"\\u00e9\\x41\", 'quoted key' = v]\n"
+            "[multi = \"\"\"\n"
+            "first line\n"
+            "  \"quoted\" inside, [not an alist] # nor a comment\n"
+            "\"\"\", after = 1]\n"
+            "{a: 1, b: {c: [d, e]}}\n"
+            "plain-literal\n"
+            "\"top string\"\n"
+            "[deep=[[[[[[x]]]]]], empty=[], e2={}]\n"
+            "# comment line\n"
+            "[x, y # trailing comment\n"
+            ", z]\n"
+            "[dup=1, dup=2, n=-3.5e2, t=true, nil=null]\n");
+        // Nested alists on lines of their own, for the lazy and parallel
+        // parsers to skip and split.
+        std::string wide;
+        for (int i = 0; i < 300; ++i) {
+            wide += "[id=" + std::to_string(i) + ", name=\"n\\t" + std::to_string(i) +
+                    "\", tags=[a, 'b c', [" + std::to_string(i % 7) + "]],\n"
+                    "  text=\"\"\"\nline " + std::to_string(i) + "\n\"\"\", end]\n";
+        }
+        corpus.push_back(wide);
+        return corpus;
+    }
+}
+
+#define CHECK(c) test::Check((c), #c, __FILE__, __LINE__)
+
+#endif